@@ -100,14 +100,27 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
 #include <limits.h>
 #include <signal.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
 #include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#include <linux/blkzoned.h>
 
 #if HAVE_ZLIB
 #include <zlib.h>
@@ -142,17 +155,136 @@
 #define DEFAULT_CHUNK_COUNT 2
 #endif
 
+// Allow compile-time customization of default queue depth for the aio engine.
+#ifndef DEFAULT_IODEPTH
+#define DEFAULT_IODEPTH 8
+#endif
+
+// Maximum number of bytes read per call to readv in read mode
+#ifndef READ_BATCH_BYTES
+#define READ_BATCH_BYTES (16*MiB)
+#endif
+
+// Exit status when the watchdog aborts a hung run (the same as timeout(1))
+#ifndef WATCHDOG_EXIT_CODE
+#define WATCHDOG_EXIT_CODE 124
+#endif
+
+// Maximum number of values in a list option
+#define LIST_MAX 16
+
+// Maximum flush benchmark queue depth (one thread per queue entry)
+#ifndef FLUSH_MAX_DEPTH
+#define FLUSH_MAX_DEPTH 256
+#endif
+
 // Show help message
 void usage(const char *argv0) {
     printf(
-      "Usage: %s [options] OUTFILE [LENGTH [ITERS]]\n"
+      "Usage: %s [options] FILE [LENGTH [ITERS]]\n"
       "\n"
       "Options:\n"
       "  -h,      --help      .Show this message\n"
       "  -s SIZE, --size=SIZE  Specifies chunk size in bytes [%lu]\n"
       "  -c NUM,  --count=NUM  Number of unique chunks [%u]\n"
       "  -n,      --dry-run    Dry run, no data written\n"
+      "  -r,      --read       Read FILE instead of writing it\n"
+      "           --verify     Verify data read in read mode\n"
       "  -v,      --verbose    Display more info\n"
+      "           --rwmix=PCT  Mixed read/write, PCT%% of chunk I/Os are reads\n"
+      "           --engine=ENGINE\n"
+      "                        I/O engine, sync or aio [sync]\n"
+      "           --iodepth=N  Chunk I/Os in flight for aio engine [%d]\n"
+      "           --discard[=FRAC]\n"
+      "                        Discard FRAC of LENGTH between iterations [1.0]\n"
+      "           --wal=RECSIZE\n"
+      "                        Append and sync RECSIZE byte records to FILE\n"
+      "           --wal-sync=METHOD\n"
+      "                        fdatasync, dsync or rwf_dsync [fdatasync]\n"
+      "           --committers=N\n"
+      "                        Concurrent committers for --wal [1]\n"
+      "           --files=N    Create N files of SIZE bytes under directory FILE\n"
+      "           --fanout=W[:D]\n"
+      "                        Spread --files over D levels of W subdirs [16:1]\n"
+      "           --threads=N  Threads creating files for --files [1]\n"
+      "           --fsync      Fsync each file created by --files\n"
+      "           --unlink     Unlink each file created by --files\n"
+      "           --fill=PCT   Fill FILE (directory or device) to PCT%% full\n"
+      "           --age=FRAC   Delete FRAC of --fill data and refill, ITERS times\n"
+      "           --zoned      Write zones of zoned device FILE sequentially\n"
+      "           --rmw=MIN[:MAX]\n"
+      "                        Buffered random overwrites of MIN to MAX bytes\n"
+      "           --replay=TRACE\n"
+      "                        Replay I/O trace TRACE against FILE\n"
+      "           --replay-speed=X\n"
+      "                        Replay at X times original speed, 0 for ASAP [1]\n"
+      "           --sync=POLICY\n"
+      "                        none, iter, every:N (chunks) or bytes:SIZE [none]\n"
+      "           --sync-call=CALL\n"
+      "                        fsync, fdatasync or sync_file_range [fdatasync]\n"
+      "           --write-behind=SIZE[:N]\n"
+      "                        Buffered writes with writeback started every SIZE\n"
+      "                        bytes, waiting for the window N back [N=2]\n"
+      "           --drop-behind\n"
+      "                        Drop written windows from the page cache\n"
+      "           --io=MODE    direct, buffered, dsync or sync [direct]\n"
+      "           --drop-cache Drop FILE from the page cache before each iter\n"
+      "           --ab=MODE    Alternate iterations between --io and MODE\n"
+      "           --flush-bench=N\n"
+      "                        Run N ops per thread of the flush microbenchmark\n"
+      "           --flush-sizes=LIST\n"
+      "                        Write sizes of --flush-bench [4k,16k,64k]\n"
+      "           --flush-depths=LIST\n"
+      "                        Queue depths (threads) of --flush-bench [1,4,16]\n"
+      "           --state=FILE Save run state to FILE for --resume\n"
+      "           --checkpoint=N\n"
+      "                        Save run state every N iterations [1]\n"
+      "           --resume     Continue the run saved in the --state file\n"
+      "           --total-bytes=SIZE\n"
+      "                        Stop after writing SIZE bytes in total\n"
+      "           --runtime=DURATION\n"
+      "                        Stop after DURATION (s/m/h/d suffix allowed)\n"
+      "           --tolerate=N Continue past up to N write errors\n"
+      "           --retries=N  Retries of failed chunks with --tolerate [3]\n"
+      "           --retry-delay=DURATION\n"
+      "                        Delay between retries [0.1s]\n"
+      "           --bad-map=FILE\n"
+      "                        Record bad regions in FILE and skip known ones\n"
+      "           --watchdog=WARN[:ABORT]\n"
+      "                        Warn when an I/O is outstanding for WARN, exit\n"
+      "                        with status %d after ABORT\n"
+      "           --duty=ON:OFF\n"
+      "                        Idle for OFF after running for ON (durations)\n"
+      "           --rate=SIZE  Limit I/O to SIZE bytes per second\n"
+      "           --target-p99=DURATION\n"
+      "                        Adapt aio depth (up to iodepth) to keep p99\n"
+      "                        latency within DURATION (ms/us suffix allowed)\n"
+      "           --open-loop=IOPS\n"
+      "                        Issue chunk I/Os at IOPS per second regardless\n"
+      "                        of completions\n"
+      "           --poisson    Open loop arrivals are a Poisson process\n"
+      "           --bursts=ON:OFF\n"
+      "                        Open loop arrivals only during ON of each ON+OFF\n"
+      "           --sweep      Run every combination of the -s, -c, LENGTH,\n"
+      "                        --iodepth and --jobs lists, output CSV\n"
+      "           --jobs=N     Parallel processes per sweep point [1]\n"
+      "           --iovs=N     Chunks per writev or readv call\n"
+      "           --autotune[=P99]\n"
+      "                        Find the fastest chunk size and iovs or iodepth\n"
+      "                        with p99 latency within P99, then exit\n"
+      "           --autotune-run\n"
+      "                        Continue the run with the autotuned settings\n"
+      "           --warmup=N|DURATION\n"
+      "                        Exclude the first N iterations, or those that\n"
+      "                        start within DURATION, from statistics\n"
+      "           --json=FILE  Append the iteration throughputs and latency\n"
+      "                        summaries to FILE as a line of JSON\n"
+      "           --bench=OUT  Run the benchmark suite with FILE (a scratch\n"
+      "                        file or block device) as the target and save\n"
+      "                        the results to OUT as JSON\n"
+      "           --compare=BASELINE\n"
+      "                        Compare the JSON results in FILE to BASELINE,\n"
+      "                        exit with status 1 on a significant regression\n"
 //    "  -V,   --version        Show version\n"
       "\n"
       "Defaults:\n"
@@ -163,7 +295,8 @@ void usage(const char *argv0) {
       "\n"
       "LEGNTH and SIZE can have suffix of k/m/g/t/p for KiB/MiB/GiB/TiB/PiB\n"
       "Passing 0 for ITERS means loop forever\n"
-      ,argv0, (size_t)DEFAULT_CHUNK_SIZE, DEFAULT_CHUNK_COUNT
+      ,argv0, (size_t)DEFAULT_CHUNK_SIZE, DEFAULT_CHUNK_COUNT, DEFAULT_IODEPTH,
+      WATCHDOG_EXIT_CODE
     );
 }
 
@@ -197,6 +330,81 @@ size_t strtosize(const char *s)
   return size;
 }
 
+// Converts a duration with an optional s/m/h/d suffix (seconds by default)
+// to seconds.  Returns 0 if s is not a positive duration.
+double strtoduration(const char *s)
+{
+  char * suffix;
+  double secs = strtod(s, &suffix);
+
+  switch(*suffix) {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      secs *= suffix[1] == 's' ? 1e-3 : 60;
+      break;
+    case 'u':
+      secs *= 1e-6;
+      break;
+    case 'h':
+      secs *= 3600;
+      break;
+    case 'd':
+      secs *= 86400;
+      break;
+    default:
+      return 0;
+  }
+
+  return secs > 0 ? secs : 0;
+}
+
+// Formats secs as [Nd]HH:MM:SS into buf
+void format_duration(char * buf, size_t len, double secs)
+{
+  uint64_t t = secs + 0.5;
+
+  if(t >= 86400) {
+    snprintf(buf, len, "%lud%02lu:%02lu:%02lu", t / 86400,
+        (t / 3600) % 24, (t / 60) % 60, t % 60);
+  } else {
+    snprintf(buf, len, "%02lu:%02lu:%02lu", t / 3600, (t / 60) % 60, t % 60);
+  }
+}
+
+// Parses a comma separated list of sizes into vals, which has room for max
+// values.  An item of the form LO-HI is a range that expands to LO, 2*LO,
+// 4*LO, ... up to HI.  Returns the number of values or -1 if s has too many
+// values, any value is zero or any range is empty.
+int parse_size_list(const char * s, uint64_t * vals, int max)
+{
+  int n = 0;
+  uint64_t lo;
+  uint64_t hi;
+  const char * comma;
+  const char * dash;
+
+  while(s && *s) {
+    comma = strchr(s, ',');
+    dash = strchr(s, '-');
+    lo = strtosize(s);
+    hi = (dash && (!comma || dash < comma)) ? strtosize(dash + 1) : lo;
+    if(lo == 0 || hi < lo) {
+      return -1;
+    }
+    for(; lo <= hi; lo *= 2) {
+      if(n == max) {
+        return -1;
+      }
+      vals[n++] = lo;
+    }
+    s = comma ? comma + 1 : NULL;
+  }
+
+  return n;
+}
+
 // Enum for command line parsing status
 enum cmdline_status {
   cmdline_ok,
@@ -204,12 +412,200 @@ enum cmdline_status {
   cmdline_error
 };
 
+// Enum for I/O modes selected by --io.  io_mode_flags holds the open flags of
+// each mode.
+enum io_mode {
+  io_direct,
+  io_buffered,
+  io_dsync,
+  io_sync
+};
+
+static const char * io_mode_names[] = {"direct", "buffered", "dsync", "sync"};
+static const int io_mode_flags[] = {
+  O_DIRECT, 0, O_DIRECT | O_DSYNC, O_DIRECT | O_SYNC
+};
+
+// Returns the io_mode named s, or -1 if s does not name an I/O mode
+int parse_io_mode(const char * s)
+{
+  int i;
+
+  for(i=0; i<(int)(sizeof(io_mode_names)/sizeof(io_mode_names[0])); i++) {
+    if(!strcmp(s, io_mode_names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Enum for I/O engines
+enum io_engine {
+  engine_sync,
+  engine_aio
+};
+
+// Enum for ways of making WAL records durable
+enum wal_sync {
+  wal_sync_fdatasync,
+  wal_sync_dsync,
+  wal_sync_rwf_dsync
+};
+
+// Enum for sync cadence policies of the write loop
+enum sync_mode {
+  sync_none,
+  sync_iter,
+  sync_every,
+  sync_bytes
+};
+
+// Enum for calls used to sync written data
+enum sync_call {
+  sync_call_fsync,
+  sync_call_fdatasync,
+  sync_call_sfr
+};
+
 // Structure to hold parameters from command line options
 struct dh_opts {
   size_t chunk_size;
   uint32_t chunk_count;
   int dry_run;
   int verbose;
+  int rwmix; // Percentage of reads for mixed workload, -1 for write only
+  int read_mode;
+  int verify;
+  enum io_engine engine;
+  int iodepth;
+  double discard; // Fraction of target to discard between iterations
+  size_t wal_record; // Record size for WAL workload, 0 if not used
+  enum wal_sync wal_sync;
+  int committers;
+  uint64_t files; // Files per iteration for metadata workload, 0 if not used
+  int fanout_width;
+  int fanout_depth;
+  int threads;
+  int fsync;
+  int unlink;
+  double fill; // Target fullness percentage for fill mode, 0 if not used
+  double age;  // Fraction of filled data to delete and refill
+  int zoned;
+  size_t rmw_min; // Record size range for partial overwrites, 0 if not used
+  size_t rmw_max;
+  const char * replay; // Trace file to replay, NULL if not used
+  double replay_speed;
+  enum sync_mode sync_mode;
+  uint64_t sync_every; // Chunks for sync_every, bytes for sync_bytes
+  enum sync_call sync_call;
+  size_t wb_window;
+  int wb_lag;
+  int wb_drop;
+  int io;    // -1 for O_DIRECT when supported
+  int ab_io; // -1 for no A/B comparison
+  int drop_cache;
+  uint64_t flush_ops;
+  uint64_t flush_sizes[LIST_MAX];
+  int nflush_sizes;
+  uint64_t flush_depths[LIST_MAX];
+  int nflush_depths;
+  int sweep;
+  uint64_t sweep_sizes[LIST_MAX];
+  int nsweep_sizes;
+  uint64_t sweep_counts[LIST_MAX];
+  int nsweep_counts;
+  uint64_t sweep_depths[LIST_MAX];
+  int nsweep_depths;
+  uint64_t sweep_jobs[LIST_MAX];
+  int nsweep_jobs;
+  uint64_t iovs;         // Chunks per call, 0 for the default
+  int autotune;
+  double autotune_p99;   // seconds, 0 for no latency limit
+  int autotune_run;
+  int warmup;            // Set if --warmup was given
+  int warmup_iters;
+  double warmup_secs;
+  const char * json;     // Results file for --json, NULL if not used
+  const char * bench;    // Results file for --bench, NULL if not used
+  const char * compare;  // Baseline file for --compare, NULL if not used
+  const char * state;
+  int checkpoint;
+  int resume;
+  uint64_t total_bytes;
+  double runtime; // seconds
+  int tolerant;
+  uint64_t error_budget;
+  int retries;
+  double retry_delay; // seconds
+  const char * bad_map;
+  double watchdog_warn;  // seconds, 0 for no watchdog
+  double watchdog_abort; // seconds, 0 to never abort
+  double duty_on;        // seconds, 0 for no duty cycle
+  double duty_off;       // seconds
+  uint64_t rate;         // bytes per second, 0 for unlimited
+  double target_p99;     // seconds, 0 for fixed iodepth
+  double open_iops;      // 0 for closed loop
+  int poisson;
+  double burst_on;       // seconds, 0 for continuous arrivals
+  double burst_off;      // seconds
+};
+
+// Option codes for long options that have no short option equivalent
+enum long_only_opts {
+  OPT_RWMIX = 256,
+  OPT_VERIFY,
+  OPT_ENGINE,
+  OPT_IODEPTH,
+  OPT_DISCARD,
+  OPT_WAL,
+  OPT_WAL_SYNC,
+  OPT_COMMITTERS,
+  OPT_FILES,
+  OPT_FANOUT,
+  OPT_THREADS,
+  OPT_FSYNC,
+  OPT_UNLINK,
+  OPT_FILL,
+  OPT_AGE,
+  OPT_ZONED,
+  OPT_RMW,
+  OPT_REPLAY,
+  OPT_REPLAY_SPEED,
+  OPT_SYNC,
+  OPT_SYNC_CALL,
+  OPT_WRITE_BEHIND,
+  OPT_DROP_BEHIND,
+  OPT_IO,
+  OPT_DROP_CACHE,
+  OPT_AB,
+  OPT_FLUSH_BENCH,
+  OPT_FLUSH_SIZES,
+  OPT_FLUSH_DEPTHS,
+  OPT_STATE,
+  OPT_CHECKPOINT,
+  OPT_RESUME,
+  OPT_TOTAL_BYTES,
+  OPT_RUNTIME,
+  OPT_TOLERATE,
+  OPT_RETRIES,
+  OPT_RETRY_DELAY,
+  OPT_BAD_MAP,
+  OPT_WATCHDOG,
+  OPT_DUTY,
+  OPT_RATE,
+  OPT_TARGET_P99,
+  OPT_OPEN_LOOP,
+  OPT_POISSON,
+  OPT_BURSTS,
+  OPT_SWEEP,
+  OPT_JOBS,
+  OPT_IOVS,
+  OPT_AUTOTUNE,
+  OPT_AUTOTUNE_RUN,
+  OPT_WARMUP,
+  OPT_JSON,
+  OPT_BENCH,
+  OPT_COMPARE
 };
 
 // Returns index of first non-option argv element (i.e. filename) or
@@ -218,26 +614,106 @@ struct dh_opts {
 int parse_command_line(int argc, char * argv[], struct dh_opts * opts)
 {
   int opt;
+  int i;
+  long leaves;
+  char * endptr;
+  char argbuf[64];
   enum cmdline_status cmdline_status = cmdline_ok;
 
   // Working values that will update opts just before successful return
   struct dh_opts tmp_opts = {
     .chunk_size = DEFAULT_CHUNK_SIZE,
     .chunk_count = DEFAULT_CHUNK_COUNT,
-    .dry_run = 0
+    .dry_run = 0,
+    .rwmix = -1,
+    .engine = engine_sync,
+    .iodepth = DEFAULT_IODEPTH,
+    .wal_sync = wal_sync_fdatasync,
+    .committers = 1,
+    .fanout_width = 16,
+    .fanout_depth = 1,
+    .threads = 1,
+    .replay_speed = 1.0,
+    .sync_mode = sync_none,
+    .sync_call = sync_call_fdatasync,
+    .wb_lag = 2,
+    .io = -1,
+    .ab_io = -1,
+    .flush_sizes = {4*KiB, 16*KiB, 64*KiB},
+    .nflush_sizes = 3,
+    .flush_depths = {1, 4, 16},
+    .nflush_depths = 3,
+    .checkpoint = 1,
+    .retries = 3,
+    .retry_delay = 0.1
   };
 
   static struct option long_opts[] = {
     {"help",     0, NULL, 'h'},
-    {"size",     0, NULL, 's'},
-    {"count",    0, NULL, 'c'},
+    {"size",     1, NULL, 's'},
+    {"count",    1, NULL, 'c'},
     {"dry-run",  0, NULL, 'n'},
+    {"read",     0, NULL, 'r'},
+    {"verify",   0, NULL, OPT_VERIFY},
     {"verbose",  0, NULL, 'v'},
+    {"rwmix",    1, NULL, OPT_RWMIX},
+    {"engine",   1, NULL, OPT_ENGINE},
+    {"iodepth",  1, NULL, OPT_IODEPTH},
+    {"discard",  2, NULL, OPT_DISCARD},
+    {"wal",      1, NULL, OPT_WAL},
+    {"wal-sync", 1, NULL, OPT_WAL_SYNC},
+    {"committers", 1, NULL, OPT_COMMITTERS},
+    {"files",    1, NULL, OPT_FILES},
+    {"fanout",   1, NULL, OPT_FANOUT},
+    {"threads",  1, NULL, OPT_THREADS},
+    {"fsync",    0, NULL, OPT_FSYNC},
+    {"unlink",   0, NULL, OPT_UNLINK},
+    {"fill",     1, NULL, OPT_FILL},
+    {"age",      1, NULL, OPT_AGE},
+    {"zoned",    0, NULL, OPT_ZONED},
+    {"rmw",      1, NULL, OPT_RMW},
+    {"replay",   1, NULL, OPT_REPLAY},
+    {"replay-speed", 1, NULL, OPT_REPLAY_SPEED},
+    {"sync",     1, NULL, OPT_SYNC},
+    {"sync-call", 1, NULL, OPT_SYNC_CALL},
+    {"write-behind", 1, NULL, OPT_WRITE_BEHIND},
+    {"drop-behind", 0, NULL, OPT_DROP_BEHIND},
+    {"io",       1, NULL, OPT_IO},
+    {"drop-cache", 0, NULL, OPT_DROP_CACHE},
+    {"ab",       1, NULL, OPT_AB},
+    {"flush-bench", 1, NULL, OPT_FLUSH_BENCH},
+    {"flush-sizes", 1, NULL, OPT_FLUSH_SIZES},
+    {"flush-depths", 1, NULL, OPT_FLUSH_DEPTHS},
+    {"state",    1, NULL, OPT_STATE},
+    {"checkpoint", 1, NULL, OPT_CHECKPOINT},
+    {"resume",   0, NULL, OPT_RESUME},
+    {"total-bytes", 1, NULL, OPT_TOTAL_BYTES},
+    {"runtime",  1, NULL, OPT_RUNTIME},
+    {"tolerate", 1, NULL, OPT_TOLERATE},
+    {"retries",  1, NULL, OPT_RETRIES},
+    {"retry-delay", 1, NULL, OPT_RETRY_DELAY},
+    {"bad-map",  1, NULL, OPT_BAD_MAP},
+    {"watchdog", 1, NULL, OPT_WATCHDOG},
+    {"duty",     1, NULL, OPT_DUTY},
+    {"rate",     1, NULL, OPT_RATE},
+    {"target-p99", 1, NULL, OPT_TARGET_P99},
+    {"open-loop", 1, NULL, OPT_OPEN_LOOP},
+    {"poisson",  0, NULL, OPT_POISSON},
+    {"bursts",   1, NULL, OPT_BURSTS},
+    {"sweep",    0, NULL, OPT_SWEEP},
+    {"jobs",     1, NULL, OPT_JOBS},
+    {"iovs",     1, NULL, OPT_IOVS},
+    {"autotune", 2, NULL, OPT_AUTOTUNE},
+    {"autotune-run", 0, NULL, OPT_AUTOTUNE_RUN},
+    {"warmup",   1, NULL, OPT_WARMUP},
+    {"json",     1, NULL, OPT_JSON},
+    {"bench",    1, NULL, OPT_BENCH},
+    {"compare",  1, NULL, OPT_COMPARE},
 //  {"version",  0, NULL, 'V'},
     {0,0,0,0}
   };
 
-  while((opt=getopt_long(argc,argv,"hc:ns:v",long_opts,NULL))!=-1) {
+  while((opt=getopt_long(argc,argv,"hc:nrs:v",long_opts,NULL))!=-1) {
     switch (opt) {
       case 'h':
         usage(argv[0]);
@@ -245,8 +721,11 @@ int parse_command_line(int argc, char * argv[], struct dh_opts * opts)
         break;
 
       case 'c':
+        // Lists and ranges are for --sweep, which checks them later
+        tmp_opts.nsweep_counts = parse_size_list(optarg,
+            tmp_opts.sweep_counts, LIST_MAX);
         tmp_opts.chunk_count = strtoul(optarg, NULL, 0);
-        if(tmp_opts.chunk_count == 0) {
+        if(tmp_opts.chunk_count == 0 || tmp_opts.nsweep_counts < 0) {
           fprintf(stderr, "chunk count cannot be zero\n");
           cmdline_status = cmdline_error;
         }
@@ -256,9 +735,19 @@ int parse_command_line(int argc, char * argv[], struct dh_opts * opts)
         tmp_opts.dry_run = 1;
         break;
 
+      case 'r':
+        tmp_opts.read_mode = 1;
+        break;
+
+      case OPT_VERIFY:
+        tmp_opts.verify = 1;
+        break;
+
       case 's':
+        tmp_opts.nsweep_sizes = parse_size_list(optarg,
+            tmp_opts.sweep_sizes, LIST_MAX);
         tmp_opts.chunk_size = strtosize(optarg);
-        if(tmp_opts.chunk_count == 0) {
+        if(tmp_opts.chunk_size == 0 || tmp_opts.nsweep_sizes < 0) {
           fprintf(stderr, "chunk size cannot be zero\n");
           cmdline_status = cmdline_error;
         }
@@ -268,169 +757,5502 @@ int parse_command_line(int argc, char * argv[], struct dh_opts * opts)
         tmp_opts.verbose = 1;
         break;
 
-      case '?': // Command line parsing error
-      default:
-        cmdline_status = cmdline_error;
+      case OPT_RWMIX:
+        tmp_opts.rwmix = strtol(optarg, NULL, 0);
+        if(tmp_opts.rwmix < 0 || tmp_opts.rwmix > 100) {
+          fprintf(stderr, "read percentage must be from 0 to 100\n");
+          cmdline_status = cmdline_error;
+        }
         break;
-    }
 
-    if(cmdline_status != cmdline_ok) {
-      break;
-    }
-  }
+      case OPT_ENGINE:
+        if(!strcmp(optarg, "sync")) {
+          tmp_opts.engine = engine_sync;
+        } else if(!strcmp(optarg, "aio")) {
+          tmp_opts.engine = engine_aio;
+        } else {
+          fprintf(stderr, "unknown engine %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  if(cmdline_status == cmdline_error) {
-    return -1;
-  } else if(cmdline_status == cmdline_help) {
-    return 0;
-  }
+      case OPT_IODEPTH:
+        tmp_opts.nsweep_depths = parse_size_list(optarg,
+            tmp_opts.sweep_depths, LIST_MAX);
+        tmp_opts.iodepth = strtol(optarg, NULL, 0);
+        for(i=0; i<tmp_opts.nsweep_depths; i++) {
+          if(tmp_opts.sweep_depths[i] > 4096) {
+            tmp_opts.iodepth = 0;
+          }
+        }
+        if(tmp_opts.iodepth < 1 || tmp_opts.iodepth > 4096 ||
+            tmp_opts.nsweep_depths < 0) {
+          fprintf(stderr, "iodepth must be from 1 to 4096\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  // If a filename was given, optind will be less than argc, otherwise it is an
-  // error.
-  if(optind >= argc) {
-    usage(argv[0]);
-    return -1;
-  }
+      case OPT_DISCARD:
+        tmp_opts.discard = optarg ? strtod(optarg, NULL) : 1.0;
+        if(tmp_opts.discard <= 0 || tmp_opts.discard > 1) {
+          fprintf(stderr, "discard fraction must be greater than 0 and"
+              " no more than 1\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  // Success, update opts
-  *opts = tmp_opts;
+      case OPT_WAL:
+        tmp_opts.wal_record = strtosize(optarg);
+        if(tmp_opts.wal_record == 0) {
+          fprintf(stderr, "record size cannot be zero\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  return optind;
-}
+      case OPT_WAL_SYNC:
+        if(!strcmp(optarg, "fdatasync")) {
+          tmp_opts.wal_sync = wal_sync_fdatasync;
+        } else if(!strcmp(optarg, "dsync")) {
+          tmp_opts.wal_sync = wal_sync_dsync;
+        } else if(!strcmp(optarg, "rwf_dsync")) {
+          tmp_opts.wal_sync = wal_sync_rwf_dsync;
+        } else {
+          fprintf(stderr, "unknown wal sync method %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-static int run = 1;
+      case OPT_COMMITTERS:
+        tmp_opts.committers = strtol(optarg, NULL, 0);
+        if(tmp_opts.committers < 1 || tmp_opts.committers > 1024) {
+          fprintf(stderr, "committers must be from 1 to 1024\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-void signal_handler(int signal)
-{
-  struct sigaction sigact = {
-    .sa_handler = SIG_DFL
-  };
+      case OPT_FILES:
+        tmp_opts.files = strtoul(optarg, NULL, 0);
+        if(tmp_opts.files == 0) {
+          fprintf(stderr, "number of files cannot be zero\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  if(signal == SIGINT) {
-    printf("...exiting after current iteration...\n");
-    fflush(stdout);
-    run = 0;
-    // Restore default signal handler so that another SIGINT will interrupt
-    // immediately.
-    sigaction(SIGINT, &sigact, NULL);
-  }
-}
+      case OPT_FANOUT:
+        tmp_opts.fanout_width = strtol(optarg, &endptr, 0);
+        tmp_opts.fanout_depth = (*endptr == ':') ?
+          strtol(endptr+1, NULL, 0) : 1;
+        leaves = 1;
+        for(i=0; i<tmp_opts.fanout_depth && leaves <= 1000000; i++) {
+          leaves *= tmp_opts.fanout_width;
+        }
+        if(tmp_opts.fanout_width < 0 || tmp_opts.fanout_depth < 0 ||
+            leaves > 1000000) {
+          fprintf(stderr, "fanout must not exceed 1000000 leaf directories\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-#if HAVE_ZLIB
-//When the fairly ubiquitous zlib library is available, the verbose option will
-//also display a 32 bit CRC value of each unique chunk.  The value displayed is
-//the same value that would be given by the ubiquitous `cksum` utility (part of
-//the `coreutils` package on Ubuntu).  This allows for spot checking the
-//integrity of aritrary chunks from the output file.
-//
-// The `zlib` library has a CRC-32 function that uses the same generator
-// polynomial as the `cksum` utility's internal CRC-32 code, but the
-// implementations treat the bit in each byte of intput data in reverse order.
-// To get results from `zlib` that match `cksum`, each byte must be
-// bit-reversed before being passed to `crc32()` and the 32-bit output must
-// also be bit reversed!  Additionally, the `cksum` utility appends the length
-// of the data to the byte sequence, LSB first and omitting any trailing zero
-// bytes.  A great resource for understanding the plethora of CRC variants is
-// this document: http://zlib.net/crc_v3.txt
-//
-// This `zlib_cksum()` function takes the above into account and uses a
-// combination of data massaging and zlib's `crc32()` function to return a CRC
-// value that equals the CRC value output by the `cksum` utility given the same
-// input data.
-uint32_t zlib_cksum(uint32_t cksum, char * buf, size_t len)
-{
-// Macro to bit reverse a byte
-#define BITREV8(b) \
-  ( \
-    (((b) & 0x01) << 7) | (((b) & 0x02) << 5) | \
-    (((b) & 0x04) << 3) | (((b) & 0x08) << 1) | \
-    (((b) & 0x10) >> 1) | (((b) & 0x20) >> 3) | \
-    (((b) & 0x40) >> 5) | (((b) & 0x80) >> 7)   \
-  )
+      case OPT_THREADS:
+        tmp_opts.threads = strtol(optarg, NULL, 0);
+        if(tmp_opts.threads < 1 || tmp_opts.threads > 1024) {
+          fprintf(stderr, "threads must be from 1 to 1024\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-// Macro to bit reverse a 32-bit word
-#define BITREV32(w) \
-  ( \
-    (BITREV8((w)       & 0xff) << 24) | \
-    (BITREV8((w) >>  8 & 0xff) << 16) | \
-    (BITREV8((w) >> 16 & 0xff) <<  8) | \
-    (BITREV8((w) >> 24 & 0xff)      )   \
-  )
+      case OPT_FSYNC:
+        tmp_opts.fsync = 1;
+        break;
 
-  size_t i;
-  char c;
+      case OPT_UNLINK:
+        tmp_opts.unlink = 1;
+        break;
 
-  // Bit reverse cksum on input
-  cksum = BITREV32(cksum);
+      case OPT_FILL:
+        tmp_opts.fill = strtod(optarg, NULL);
+        if(tmp_opts.fill <= 0 || tmp_opts.fill > 100) {
+          fprintf(stderr, "fill percentage must be greater than 0 and"
+              " no more than 100\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  // Feed bit reversed data bytes to zlib's crc32
-  for(i=0; i<len; i++) {
-    c = BITREV8(buf[i]);
-    cksum = crc32(cksum, &c, 1);
-  }
-  // Feed bit reversed len bytes to zlib's crc32
-  // LSB first, omit trailing zero bytes
-  for(; len; len >>= 8) {
-    c = BITREV8(len & 0xff);
-    cksum = crc32(cksum, &c, 1);
-  }
+      case OPT_ZONED:
+        tmp_opts.zoned = 1;
+        break;
 
-  // Bit reverse cksum on output
-  return BITREV32(cksum);
-}
-#endif  // HAVE_ZLIB
+      case OPT_RMW:
+        tmp_opts.rmw_min = strtosize(optarg);
+        endptr = strchr(optarg, ':');
+        tmp_opts.rmw_max = endptr ? strtosize(endptr+1) : tmp_opts.rmw_min;
+        if(tmp_opts.rmw_min == 0 || tmp_opts.rmw_max < tmp_opts.rmw_min) {
+          fprintf(stderr, "invalid rmw record size range %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-int main(int argc, char *argv[])
-{
-  int i;
-  int fd;
-  int argi;
-  int oflags;
-  int niters;
-  size_t file_size;
-  size_t buffer_size;
-  uint64_t file_chunks;
-  int alignment;
-  int iovs_idx;
-  uint64_t iovs_remaining;
-  uint64_t iovs_to_write;
-  ssize_t bytes_written;
-  ssize_t bytes_written_partial;
-  char * buffer;
-  struct iovec * iovs;
-  struct iovec * piov;
-  char * filename;
-  char * slash;
-  struct timespec start, stop;
-  int64_t elapsed_ns;
-  struct dh_opts opts;
-  time_t now;
-  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
-  struct sigaction sigact = {
-    .sa_handler = signal_handler
-  };
-#if HAVE_ZLIB
-  uint32_t cksum;
-#endif
+      case OPT_REPLAY:
+        tmp_opts.replay = optarg;
+        break;
 
-  argi = parse_command_line(argc, argv, &opts);
+      case OPT_REPLAY_SPEED:
+        tmp_opts.replay_speed = strtod(optarg, NULL);
+        if(tmp_opts.replay_speed < 0) {
+          fprintf(stderr, "replay speed cannot be negative\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  if(argi < 1) {
-    return -argi;
-  }
+      case OPT_SYNC:
+        if(!strcmp(optarg, "none")) {
+          tmp_opts.sync_mode = sync_none;
+        } else if(!strcmp(optarg, "iter")) {
+          tmp_opts.sync_mode = sync_iter;
+        } else if(!strncmp(optarg, "every:", 6)) {
+          tmp_opts.sync_mode = sync_every;
+          tmp_opts.sync_every = strtoul(optarg+6, NULL, 0);
+        } else if(!strncmp(optarg, "bytes:", 6)) {
+          tmp_opts.sync_mode = sync_bytes;
+          tmp_opts.sync_every = strtosize(optarg+6);
+        } else {
+          fprintf(stderr, "unknown sync policy %s\n", optarg);
+          cmdline_status = cmdline_error;
+          break;
+        }
+        if(tmp_opts.sync_mode >= sync_every && tmp_opts.sync_every == 0) {
+          fprintf(stderr, "invalid sync policy %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  filename = argv[argi];
+      case OPT_SYNC_CALL:
+        if(!strcmp(optarg, "fsync")) {
+          tmp_opts.sync_call = sync_call_fsync;
+        } else if(!strcmp(optarg, "fdatasync")) {
+          tmp_opts.sync_call = sync_call_fdatasync;
+        } else if(!strcmp(optarg, "sync_file_range") ||
+            !strcmp(optarg, "sfr")) {
+          tmp_opts.sync_call = sync_call_sfr;
+        } else {
+          fprintf(stderr, "unknown sync call %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
 
-  file_size = 512 * MiB; // Default filesize 512 MiB
-  if(argc > argi+1) {
-    file_size = strtosize(argv[argi+1]);
+      case OPT_WRITE_BEHIND:
+        tmp_opts.wb_window = strtosize(optarg);
+        endptr = strchr(optarg, ':');
+        if(endptr) {
+          tmp_opts.wb_lag = strtol(endptr+1, NULL, 0);
+        }
+        if(tmp_opts.wb_window == 0 || tmp_opts.wb_lag < 1) {
+          fprintf(stderr, "invalid write-behind window %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_DROP_BEHIND:
+        tmp_opts.wb_drop = 1;
+        break;
+
+      case OPT_IO:
+      case OPT_AB:
+        i = parse_io_mode(optarg);
+        if(i < 0) {
+          fprintf(stderr, "unknown I/O mode %s\n", optarg);
+          cmdline_status = cmdline_error;
+        } else if(opt == OPT_IO) {
+          tmp_opts.io = i;
+        } else {
+          tmp_opts.ab_io = i;
+        }
+        break;
+
+      case OPT_DROP_CACHE:
+        tmp_opts.drop_cache = 1;
+        break;
+
+      case OPT_FLUSH_BENCH:
+        tmp_opts.flush_ops = strtoul(optarg, NULL, 0);
+        if(tmp_opts.flush_ops == 0) {
+          fprintf(stderr, "flush-bench ops must be greater than 0\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_FLUSH_SIZES:
+        tmp_opts.nflush_sizes = parse_size_list(optarg,
+            tmp_opts.flush_sizes, LIST_MAX);
+        if(tmp_opts.nflush_sizes <= 0) {
+          fprintf(stderr, "invalid flush sizes %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_FLUSH_DEPTHS:
+        // Depths are thread counts, so plain numbers without size suffixes
+        tmp_opts.nflush_depths = optarg[strspn(optarg, "0123456789,-")] ?
+          -1 : parse_size_list(optarg, tmp_opts.flush_depths, LIST_MAX);
+        for(i=0; i<tmp_opts.nflush_depths; i++) {
+          if(tmp_opts.flush_depths[i] > FLUSH_MAX_DEPTH) {
+            tmp_opts.nflush_depths = -1;
+            break;
+          }
+        }
+        if(tmp_opts.nflush_depths <= 0) {
+          fprintf(stderr, "flush depths must be from 1 to %d\n",
+              FLUSH_MAX_DEPTH);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_STATE:
+        tmp_opts.state = optarg;
+        break;
+
+      case OPT_CHECKPOINT:
+        tmp_opts.checkpoint = strtol(optarg, NULL, 0);
+        if(tmp_opts.checkpoint < 1) {
+          fprintf(stderr, "checkpoint interval must be at least 1\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_RESUME:
+        tmp_opts.resume = 1;
+        break;
+
+      case OPT_TOTAL_BYTES:
+        tmp_opts.total_bytes = strtosize(optarg);
+        if(tmp_opts.total_bytes == 0) {
+          fprintf(stderr, "invalid total bytes %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_RUNTIME:
+        tmp_opts.runtime = strtoduration(optarg);
+        if(tmp_opts.runtime == 0) {
+          fprintf(stderr, "invalid runtime %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_TOLERATE:
+        tmp_opts.tolerant = 1;
+        tmp_opts.error_budget = strtoul(optarg, &endptr, 0);
+        if(endptr == optarg || *endptr || *optarg == '-') {
+          fprintf(stderr, "invalid error budget %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_RETRIES:
+        tmp_opts.retries = strtol(optarg, NULL, 0);
+        if(tmp_opts.retries < 0) {
+          fprintf(stderr, "retries must not be negative\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_RETRY_DELAY:
+        // Zero means retry immediately
+        tmp_opts.retry_delay = strtoduration(optarg);
+        break;
+
+      case OPT_BAD_MAP:
+        tmp_opts.bad_map = optarg;
+        break;
+
+      case OPT_WATCHDOG:
+        snprintf(argbuf, sizeof(argbuf), "%s", optarg);
+        endptr = strchr(argbuf, ':');
+        if(endptr) {
+          *endptr++ = '\0';
+          tmp_opts.watchdog_abort = strtoduration(endptr);
+        }
+        tmp_opts.watchdog_warn = strtoduration(argbuf);
+        if(tmp_opts.watchdog_warn == 0 || (endptr &&
+              tmp_opts.watchdog_abort < tmp_opts.watchdog_warn)) {
+          fprintf(stderr, "invalid watchdog thresholds %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_DUTY:
+        snprintf(argbuf, sizeof(argbuf), "%s", optarg);
+        endptr = strchr(argbuf, ':');
+        if(endptr) {
+          *endptr++ = '\0';
+          tmp_opts.duty_off = strtoduration(endptr);
+        }
+        tmp_opts.duty_on = strtoduration(argbuf);
+        if(tmp_opts.duty_on == 0 || tmp_opts.duty_off == 0) {
+          fprintf(stderr, "invalid duty cycle %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_RATE:
+        // Any "/s" after the size suffix is ignored
+        tmp_opts.rate = strtosize(optarg);
+        if(tmp_opts.rate == 0) {
+          fprintf(stderr, "invalid rate %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_TARGET_P99:
+        tmp_opts.target_p99 = strtoduration(optarg);
+        if(tmp_opts.target_p99 == 0) {
+          fprintf(stderr, "invalid p99 target %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_OPEN_LOOP:
+        tmp_opts.open_iops = strtod(optarg, NULL);
+        if(tmp_opts.open_iops <= 0) {
+          fprintf(stderr, "invalid arrival rate %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_POISSON:
+        tmp_opts.poisson = 1;
+        break;
+
+      case OPT_BURSTS:
+        snprintf(argbuf, sizeof(argbuf), "%s", optarg);
+        endptr = strchr(argbuf, ':');
+        if(endptr) {
+          *endptr++ = '\0';
+          tmp_opts.burst_off = strtoduration(endptr);
+        }
+        tmp_opts.burst_on = strtoduration(argbuf);
+        if(tmp_opts.burst_on == 0 || tmp_opts.burst_off == 0) {
+          fprintf(stderr, "invalid burst pattern %s\n", optarg);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_SWEEP:
+        tmp_opts.sweep = 1;
+        break;
+
+      case OPT_JOBS:
+        tmp_opts.nsweep_jobs = parse_size_list(optarg,
+            tmp_opts.sweep_jobs, LIST_MAX);
+        for(i=0; i<tmp_opts.nsweep_jobs; i++) {
+          if(tmp_opts.sweep_jobs[i] > 256) {
+            tmp_opts.nsweep_jobs = -1;
+            break;
+          }
+        }
+        if(tmp_opts.nsweep_jobs < 0) {
+          fprintf(stderr, "jobs must be from 1 to 256\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_IOVS:
+        tmp_opts.iovs = strtoul(optarg, NULL, 0);
+        if(tmp_opts.iovs < 1 || tmp_opts.iovs > IOV_MAX) {
+          fprintf(stderr, "iovs must be from 1 to %d\n", IOV_MAX);
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case OPT_AUTOTUNE:
+        tmp_opts.autotune = 1;
+        if(optarg) {
+          tmp_opts.autotune_p99 = strtoduration(optarg);
+          if(tmp_opts.autotune_p99 == 0) {
+            fprintf(stderr, "invalid latency limit %s\n", optarg);
+            cmdline_status = cmdline_error;
+          }
+        }
+        break;
+
+      case OPT_AUTOTUNE_RUN:
+        tmp_opts.autotune = 1;
+        tmp_opts.autotune_run = 1;
+        break;
+
+      case OPT_WARMUP:
+        // A plain number is a count of iterations, anything else a duration
+        tmp_opts.warmup = 1;
+        if(optarg[strspn(optarg, "0123456789")] == '\0') {
+          tmp_opts.warmup_iters = strtol(optarg, NULL, 10);
+        } else {
+          tmp_opts.warmup_secs = strtoduration(optarg);
+          if(tmp_opts.warmup_secs == 0) {
+            fprintf(stderr, "invalid warmup %s\n", optarg);
+            cmdline_status = cmdline_error;
+          }
+        }
+        break;
+
+      case OPT_JSON:
+        tmp_opts.json = optarg;
+        break;
+
+      case OPT_BENCH:
+        tmp_opts.bench = optarg;
+        break;
+
+      case OPT_COMPARE:
+        tmp_opts.compare = optarg;
+        break;
+
+      case OPT_AGE:
+        tmp_opts.age = strtod(optarg, NULL);
+        if(tmp_opts.age <= 0 || tmp_opts.age > 1) {
+          fprintf(stderr, "age fraction must be greater than 0 and"
+              " no more than 1\n");
+          cmdline_status = cmdline_error;
+        }
+        break;
+
+      case '?': // Command line parsing error
+      default:
+        cmdline_status = cmdline_error;
+        break;
+    }
+
+    if(cmdline_status != cmdline_ok) {
+      break;
+    }
+  }
+
+  // Single values for any sweep parameters not given as lists
+  if(tmp_opts.nsweep_sizes == 0) {
+    tmp_opts.sweep_sizes[tmp_opts.nsweep_sizes++] = tmp_opts.chunk_size;
+  }
+  if(tmp_opts.nsweep_counts == 0) {
+    tmp_opts.sweep_counts[tmp_opts.nsweep_counts++] = tmp_opts.chunk_count;
+  }
+  if(tmp_opts.nsweep_depths == 0) {
+    tmp_opts.sweep_depths[tmp_opts.nsweep_depths++] = tmp_opts.iodepth;
+  }
+  if(tmp_opts.nsweep_jobs == 0) {
+    tmp_opts.sweep_jobs[tmp_opts.nsweep_jobs++] = 1;
+  }
+
+  // Check for incompatible options
+  if(cmdline_status == cmdline_ok) {
+    if(tmp_opts.read_mode && tmp_opts.rwmix >= 0) {
+      fprintf(stderr, "--read and --rwmix are mutually exclusive\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.verify && !tmp_opts.read_mode) {
+      fprintf(stderr, "--verify requires --read\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.read_mode && tmp_opts.discard > 0) {
+      fprintf(stderr, "--discard cannot be used with --read\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.wal_record && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--wal cannot be used with --read, --rwmix"
+          " or the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.files && (tmp_opts.read_mode || tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.discard > 0 ||
+          tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--files cannot be used with --read, --rwmix, --wal,"
+          " --discard or the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.fill > 0 && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.discard > 0 || tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--fill cannot be used with --read, --rwmix, --wal,"
+          " --files, --discard or the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.zoned && (tmp_opts.read_mode || tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.files || tmp_opts.fill > 0 ||
+          tmp_opts.discard > 0)) {
+      fprintf(stderr, "--zoned cannot be used with --read, --rwmix, --wal,"
+          " --files, --fill or --discard\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.zoned && tmp_opts.engine == engine_aio &&
+        tmp_opts.iodepth > 1) {
+      // Concurrent writes to a sequential zone can be reordered unless the
+      // kernel plugs zone writes, so only one may be in flight
+      fprintf(stderr, "--zoned with the aio engine requires --iodepth=1\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.rmw_min && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.discard > 0 ||
+          tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--rmw cannot be used with --read, --rwmix, --wal,"
+          " --files, --fill, --zoned, --discard or the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.replay && (tmp_opts.read_mode || tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.files || tmp_opts.fill > 0 ||
+          tmp_opts.zoned || tmp_opts.rmw_min || tmp_opts.discard > 0)) {
+      fprintf(stderr, "--replay cannot be used with --read, --rwmix, --wal,"
+          " --files, --fill, --zoned, --rmw or --discard\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.sync_mode != sync_none && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay)) {
+      fprintf(stderr, "--sync only applies to the write loop\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.wb_drop && !tmp_opts.wb_window) {
+      fprintf(stderr, "--drop-behind requires --write-behind\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.wb_window && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay || tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--write-behind only applies to the write loop with"
+          " the sync engine\n");
+      cmdline_status = cmdline_error;
+    } else if((tmp_opts.io >= 0 || tmp_opts.ab_io >= 0 ||
+          tmp_opts.drop_cache) && (tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay || tmp_opts.wb_window)) {
+      fprintf(stderr, "--io, --ab and --drop-cache only apply to the write,"
+          " read and mixed loops\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.flush_ops && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay || tmp_opts.wb_window || tmp_opts.discard > 0 ||
+          tmp_opts.sync_mode != sync_none || tmp_opts.io >= 0 ||
+          tmp_opts.ab_io >= 0 || tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--flush-bench cannot be combined with other modes\n");
+      cmdline_status = cmdline_error;
+    } else if((tmp_opts.total_bytes || tmp_opts.runtime > 0) &&
+        (tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.replay ||
+         tmp_opts.flush_ops)) {
+      fprintf(stderr, "--total-bytes and --runtime cannot be used with fill,"
+          " zoned, replay or flush-bench modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.total_bytes && tmp_opts.read_mode) {
+      fprintf(stderr, "--total-bytes counts bytes written, so it cannot be"
+          " used with --read\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.watchdog_warn > 0 && (tmp_opts.wal_record ||
+          tmp_opts.files || tmp_opts.fill > 0 || tmp_opts.zoned ||
+          tmp_opts.replay || tmp_opts.flush_ops || tmp_opts.sweep ||
+          (tmp_opts.autotune && !tmp_opts.autotune_run))) {
+      // These modes do I/O in calls, threads or processes the watchdog does
+      // not track
+      fprintf(stderr, "--watchdog cannot be used with wal, files, fill,"
+          " zoned, replay, flush-bench, sweep or autotune modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.bad_map && !tmp_opts.tolerant) {
+      fprintf(stderr, "--bad-map requires --tolerate\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.tolerant && (tmp_opts.read_mode ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay || tmp_opts.flush_ops ||
+          tmp_opts.engine != engine_sync)) {
+      fprintf(stderr, "--tolerate only applies to the write loop with the"
+          " sync engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.duty_on > 0 && (tmp_opts.fill > 0 || tmp_opts.zoned ||
+          tmp_opts.replay || tmp_opts.flush_ops)) {
+      fprintf(stderr, "--duty cannot be used with fill, zoned, replay or"
+          " flush-bench modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.rate && (tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.replay ||
+          tmp_opts.flush_ops)) {
+      fprintf(stderr, "--rate cannot be used with wal, files, fill, zoned,"
+          " replay or flush-bench modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.target_p99 > 0 && tmp_opts.engine != engine_aio) {
+      fprintf(stderr, "--target-p99 requires the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.open_iops > 0 && (tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.files || tmp_opts.fill > 0 ||
+          tmp_opts.zoned || tmp_opts.rmw_min || tmp_opts.replay ||
+          tmp_opts.flush_ops || tmp_opts.rate || tmp_opts.target_p99 > 0 ||
+          tmp_opts.tolerant || tmp_opts.wb_window ||
+          tmp_opts.sync_mode > sync_iter)) {
+      fprintf(stderr, "--open-loop only applies to plain write or read"
+          " loops\n");
+      cmdline_status = cmdline_error;
+    } else if((tmp_opts.poisson || tmp_opts.burst_on > 0) &&
+        tmp_opts.open_iops == 0) {
+      fprintf(stderr, "--poisson and --bursts require --open-loop\n");
+      cmdline_status = cmdline_error;
+    } else if(!tmp_opts.sweep && (tmp_opts.nsweep_sizes > 1 ||
+          tmp_opts.nsweep_counts > 1 || tmp_opts.nsweep_depths > 1 ||
+          tmp_opts.nsweep_jobs > 1 || tmp_opts.sweep_jobs[0] > 1)) {
+      fprintf(stderr, "lists, ranges and --jobs require --sweep\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.iovs && (tmp_opts.engine != engine_sync ||
+          tmp_opts.rwmix >= 0 || tmp_opts.wal_record || tmp_opts.files ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.rmw_min ||
+          tmp_opts.replay || tmp_opts.flush_ops || tmp_opts.open_iops > 0)) {
+      fprintf(stderr, "--iovs only applies to write or read loops with the"
+          " sync engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.warmup && (tmp_opts.fill > 0 || tmp_opts.zoned ||
+          tmp_opts.replay || tmp_opts.flush_ops)) {
+      fprintf(stderr, "--warmup cannot be used with fill, zoned, replay or"
+          " flush-bench modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.warmup_secs > 0 && (tmp_opts.sweep ||
+          (tmp_opts.autotune && !tmp_opts.autotune_run))) {
+      fprintf(stderr, "--sweep and --autotune take a number of warmup"
+          " iterations\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.bench && tmp_opts.compare) {
+      fprintf(stderr, "--bench and --compare are mutually exclusive\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.json && (tmp_opts.bench || tmp_opts.compare ||
+          tmp_opts.fill > 0 || tmp_opts.zoned || tmp_opts.replay ||
+          tmp_opts.flush_ops || tmp_opts.sweep ||
+          (tmp_opts.autotune && !tmp_opts.autotune_run))) {
+      fprintf(stderr, "--json cannot be used with bench, compare, fill,"
+          " zoned, replay, flush-bench, sweep or autotune modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.sweep && tmp_opts.autotune) {
+      fprintf(stderr, "--sweep and --autotune are mutually exclusive\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.sweep && (tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.files || tmp_opts.fill > 0 ||
+          tmp_opts.zoned || tmp_opts.rmw_min || tmp_opts.replay ||
+          tmp_opts.flush_ops || tmp_opts.verify || tmp_opts.state ||
+          tmp_opts.ab_io >= 0 || tmp_opts.sync_mode != sync_none ||
+          tmp_opts.wb_window || tmp_opts.tolerant || tmp_opts.rate ||
+          tmp_opts.target_p99 > 0 || tmp_opts.open_iops > 0 ||
+          tmp_opts.total_bytes || tmp_opts.runtime > 0 ||
+          tmp_opts.duty_on > 0 || tmp_opts.discard > 0)) {
+      fprintf(stderr, "--sweep only applies to plain write or read loops\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.autotune && (tmp_opts.rwmix >= 0 ||
+          tmp_opts.wal_record || tmp_opts.files || tmp_opts.fill > 0 ||
+          tmp_opts.zoned || tmp_opts.rmw_min || tmp_opts.replay ||
+          tmp_opts.flush_ops || tmp_opts.open_iops > 0 ||
+          tmp_opts.nsweep_sizes > 1 || tmp_opts.nsweep_depths > 1)) {
+      fprintf(stderr, "--autotune only applies to write or read loops with"
+          " fixed parameters\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.sweep && tmp_opts.nsweep_depths > 1 &&
+        tmp_opts.engine != engine_aio) {
+      fprintf(stderr, "an iodepth list requires the aio engine\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.resume && !tmp_opts.state) {
+      fprintf(stderr, "--resume requires --state\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.state && (tmp_opts.fill > 0 || tmp_opts.zoned ||
+          tmp_opts.replay || tmp_opts.flush_ops)) {
+      fprintf(stderr, "--state cannot be used with fill, zoned, replay or"
+          " flush-bench modes\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.ab_io >= 0 && tmp_opts.rwmix >= 0) {
+      fprintf(stderr, "--ab cannot be used with --rwmix\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.sync_mode > sync_iter &&
+        tmp_opts.engine != engine_sync) {
+      fprintf(stderr, "--sync=%s requires the sync engine\n",
+          tmp_opts.sync_mode == sync_every ? "every" : "bytes");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.rmw_max > tmp_opts.chunk_size) {
+      fprintf(stderr, "rmw record size cannot exceed chunk size\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.age > 0 && tmp_opts.fill == 0) {
+      fprintf(stderr, "--age requires --fill\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.wal_record > tmp_opts.chunk_size) {
+      fprintf(stderr, "wal record size cannot exceed chunk size\n");
+      cmdline_status = cmdline_error;
+    } else if(tmp_opts.rwmix >= 0 && tmp_opts.engine != engine_sync) {
+      fprintf(stderr, "--rwmix requires the sync engine\n");
+      cmdline_status = cmdline_error;
+    }
+  }
+
+  if(cmdline_status == cmdline_error) {
+    return -1;
+  } else if(cmdline_status == cmdline_help) {
+    return 0;
+  }
+
+  // If a filename was given, optind will be less than argc, otherwise it is an
+  // error.
+  if(optind >= argc) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Success, update opts
+  *opts = tmp_opts;
+
+  return optind;
+}
+
+static int run = 1;
+
+// Watchdog tracking of outstanding I/Os.  Each slot holds the CLOCK_MONOTONIC
+// time in ns at which the I/O outstanding in that slot was issued, or 0 if
+// the slot is idle.  Slot 0 is used by synchronous I/O of the main thread and
+// the aio engine uses one slot per iocb after that.  Nothing is tracked while
+// wd_slots is NULL.
+static int64_t * wd_slots;
+static int wd_nslots;
+
+static inline void wd_begin(int slot, const struct timespec * ts)
+{
+  if(wd_slots && slot < wd_nslots) {
+    __atomic_store_n(&wd_slots[slot], ts->tv_sec * 1000000000L + ts->tv_nsec,
+        __ATOMIC_RELAXED);
+  }
+}
+
+static inline void wd_end(int slot)
+{
+  if(wd_slots && slot < wd_nslots) {
+    __atomic_store_n(&wd_slots[slot], 0, __ATOMIC_RELAXED);
+  }
+}
+
+// Rate limiting with a token bucket, implemented as a virtual schedule: bytes
+// may be issued once the clock reaches next_ns, and issuing len bytes moves
+// next_ns len / rate later.  Falling behind by more than burst_ns forfeits
+// the excess, which bounds the size of a catch up burst.  Deadlines are
+// absolute, so pacing does not drift no matter how long the run.  Nothing is
+// paced while pacer is NULL.
+struct pacer {
+  double rate;       // bytes per second
+  double ns_per_byte;
+  int64_t burst_ns;
+  int64_t start_ns;  // Time of the first paced I/O
+  int64_t next_ns;
+  int64_t paced_ns;  // Total time spent waiting
+  uint64_t bytes;
+};
+
+static struct pacer * pacer;
+
+// Longest catch up burst after falling behind the rate limit
+#ifndef RATE_BURST_NS
+#define RATE_BURST_NS 1000000000L
+#endif
+
+// Number of pacing steps per second when batching chunks
+#ifndef PACE_HZ
+#define PACE_HZ 100
+#endif
+
+static inline int64_t mono_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Sleeps until the absolute CLOCK_MONOTONIC time ns
+static void sleep_until(int64_t ns)
+{
+  struct timespec ts = {ns / 1000000000L, ns % 1000000000L};
+
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+// Returns the number of ns to wait before the next I/O may be issued (0 if
+// it may be issued now).
+static int64_t pace_delay(void)
+{
+  int64_t now;
+
+  if(!pacer) {
+    return 0;
+  }
+  now = mono_ns();
+  if(!pacer->start_ns) {
+    pacer->start_ns = now;
+    pacer->next_ns = now;
+  } else if(pacer->next_ns < now - pacer->burst_ns) {
+    pacer->next_ns = now - pacer->burst_ns;
+  }
+  return pacer->next_ns > now ? pacer->next_ns - now : 0;
+}
+
+// Accounts for issuing len bytes
+static inline void pace_charge(size_t len)
+{
+  if(pacer) {
+    pacer->next_ns += len * pacer->ns_per_byte;
+    pacer->bytes += len;
+  }
+}
+
+// Sleeps until the next I/O may be issued, then accounts for issuing len
+// bytes.  The sleep ends at an absolute deadline.
+static void pace(size_t len)
+{
+  int64_t delay;
+
+  if((delay = pace_delay()) > 0) {
+    sleep_until(pacer->next_ns);
+    pacer->paced_ns += delay;
+  }
+  pace_charge(len);
+}
+
+// Returns the maximum number of chunks of chunk_size bytes per call, which
+// keeps paced batches to 1/PACE_HZ seconds
+static inline uint64_t pace_batch(size_t chunk_size)
+{
+  uint64_t n;
+
+  if(!pacer) {
+    return UINT64_MAX;
+  }
+  n = pacer->rate / PACE_HZ / chunk_size;
+  return n ? n : 1;
+}
+
+void signal_handler(int signal)
+{
+  struct sigaction sigact = {
+    .sa_handler = SIG_DFL
+  };
+
+  if(signal == SIGINT) {
+    printf("...exiting after current iteration...\n");
+    fflush(stdout);
+    run = 0;
+    // Restore default signal handler so that another SIGINT will interrupt
+    // immediately.
+    sigaction(SIGINT, &sigact, NULL);
+  }
+}
+
+#if HAVE_ZLIB
+//When the fairly ubiquitous zlib library is available, the verbose option will
+//also display a 32 bit CRC value of each unique chunk.  The value displayed is
+//the same value that would be given by the ubiquitous `cksum` utility (part of
+//the `coreutils` package on Ubuntu).  This allows for spot checking the
+//integrity of aritrary chunks from the output file.
+//
+// The `zlib` library has a CRC-32 function that uses the same generator
+// polynomial as the `cksum` utility's internal CRC-32 code, but the
+// implementations treat the bit in each byte of intput data in reverse order.
+// To get results from `zlib` that match `cksum`, each byte must be
+// bit-reversed before being passed to `crc32()` and the 32-bit output must
+// also be bit reversed!  Additionally, the `cksum` utility appends the length
+// of the data to the byte sequence, LSB first and omitting any trailing zero
+// bytes.  A great resource for understanding the plethora of CRC variants is
+// this document: http://zlib.net/crc_v3.txt
+//
+// This `zlib_cksum()` function takes the above into account and uses a
+// combination of data massaging and zlib's `crc32()` function to return a CRC
+// value that equals the CRC value output by the `cksum` utility given the same
+// input data.
+uint32_t zlib_cksum(uint32_t cksum, char * buf, size_t len)
+{
+// Macro to bit reverse a byte
+#define BITREV8(b) \
+  ( \
+    (((b) & 0x01) << 7) | (((b) & 0x02) << 5) | \
+    (((b) & 0x04) << 3) | (((b) & 0x08) << 1) | \
+    (((b) & 0x10) >> 1) | (((b) & 0x20) >> 3) | \
+    (((b) & 0x40) >> 5) | (((b) & 0x80) >> 7)   \
+  )
+
+// Macro to bit reverse a 32-bit word
+#define BITREV32(w) \
+  ( \
+    (BITREV8((w)       & 0xff) << 24) | \
+    (BITREV8((w) >>  8 & 0xff) << 16) | \
+    (BITREV8((w) >> 16 & 0xff) <<  8) | \
+    (BITREV8((w) >> 24 & 0xff)      )   \
+  )
+
+  size_t i;
+  char c;
+
+  // Bit reverse cksum on input
+  cksum = BITREV32(cksum);
+
+  // Feed bit reversed data bytes to zlib's crc32
+  for(i=0; i<len; i++) {
+    c = BITREV8(buf[i]);
+    cksum = crc32(cksum, &c, 1);
+  }
+  // Feed bit reversed len bytes to zlib's crc32
+  // LSB first, omit trailing zero bytes
+  for(; len; len >>= 8) {
+    c = BITREV8(len & 0xff);
+    cksum = crc32(cksum, &c, 1);
+  }
+
+  // Bit reverse cksum on output
+  return BITREV32(cksum);
+}
+#endif  // HAVE_ZLIB
+
+// Latency histogram.  Latencies are recorded in nanoseconds into log-linear
+// buckets: each power of two is split into LAT_SUB_BUCKETS linear sub-buckets.
+// This covers the full 64 bit range in a fixed size array while limiting the
+// relative error of reported percentiles to 1/LAT_SUB_BUCKETS.
+#define LAT_SUB_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_NBUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+struct lat_hist {
+  uint64_t count;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  double sum_ns;
+  uint64_t buckets[LAT_NBUCKETS];
+};
+
+// Returns index of bucket holding latency value ns
+static int lat_bucket(uint64_t ns)
+{
+  int shift;
+
+  if(ns < LAT_SUB_BUCKETS) {
+    return ns;
+  }
+  shift = 63 - __builtin_clzll(ns) - LAT_SUB_BITS;
+  return (shift + 1) * LAT_SUB_BUCKETS + ((ns >> shift) & (LAT_SUB_BUCKETS-1));
+}
+
+// Returns largest latency value that falls in bucket idx
+static uint64_t lat_bucket_max(int idx)
+{
+  int shift;
+
+  if(idx < LAT_SUB_BUCKETS) {
+    return idx;
+  }
+  shift = idx / LAT_SUB_BUCKETS - 1;
+  return ((uint64_t)(LAT_SUB_BUCKETS + idx % LAT_SUB_BUCKETS) << shift)
+    + ((1UL << shift) - 1);
+}
+
+void lat_hist_add(struct lat_hist * h, uint64_t ns)
+{
+  if(h->count == 0 || ns < h->min_ns) {
+    h->min_ns = ns;
+  }
+  if(ns > h->max_ns) {
+    h->max_ns = ns;
+  }
+  h->count++;
+  h->sum_ns += ns;
+  h->buckets[lat_bucket(ns)]++;
+}
+
+// Adds the samples of src to dst
+void lat_hist_merge(struct lat_hist * dst, const struct lat_hist * src)
+{
+  int i;
+
+  if(src->count == 0) {
+    return;
+  }
+  if(dst->count == 0 || src->min_ns < dst->min_ns) {
+    dst->min_ns = src->min_ns;
+  }
+  if(src->max_ns > dst->max_ns) {
+    dst->max_ns = src->max_ns;
+  }
+  dst->count += src->count;
+  dst->sum_ns += src->sum_ns;
+  for(i=0; i<LAT_NBUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+// Returns latency at percentile pct (0 to 100).  The value returned is the
+// upper edge of the bucket containing the percentile, clamped to the
+// observed minimum and maximum.
+uint64_t lat_hist_pct(const struct lat_hist * h, double pct)
+{
+  int i;
+  uint64_t seen = 0;
+  uint64_t target;
+  uint64_t ns;
+
+  if(h->count == 0) {
+    return 0;
+  }
+
+  target = (uint64_t)(pct / 100.0 * h->count + 0.5);
+  if(target == 0) {
+    target = 1;
+  }
+  for(i=0; i<LAT_NBUCKETS; i++) {
+    seen += h->buckets[i];
+    if(seen >= target) {
+      break;
+    }
+  }
+
+  ns = lat_bucket_max(i);
+  if(ns < h->min_ns) {
+    ns = h->min_ns;
+  } else if(ns > h->max_ns) {
+    ns = h->max_ns;
+  }
+  return ns;
+}
+
+void lat_hist_print(const char * label, const struct lat_hist * h)
+{
+  if(h->count == 0) {
+    printf("%s latency: no samples\n", label);
+    return;
+  }
+  printf("%s latency ns: count %lu min %lu avg %.0f p50 %lu p90 %lu "
+      "p99 %lu p99.9 %lu max %lu\n", label, h->count, h->min_ns,
+      h->sum_ns / h->count, lat_hist_pct(h, 50), lat_hist_pct(h, 90),
+      lat_hist_pct(h, 99), lat_hist_pct(h, 99.9), h->max_ns);
+}
+
+// Syncs len bytes at offset of fd using call.  fsync and fdatasync sync the
+// whole file, sync_file_range syncs only the given range (and does not flush
+// the device's volatile cache).  The time taken is added to hist and
+// returned, or -1 is returned on error.
+int64_t sync_range(int fd, enum sync_call call, off_t offset, off_t len,
+    struct lat_hist * hist)
+{
+  int rc;
+  struct timespec start, stop;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  wd_begin(0, &start);
+  switch(call) {
+    case sync_call_fsync:
+      rc = fsync(fd);
+      break;
+    case sync_call_fdatasync:
+      rc = fdatasync(fd);
+      break;
+    default:
+      rc = sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+          SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      break;
+  }
+  wd_end(0);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if(rc == -1) {
+    perror(call == sync_call_fsync ? "fsync" :
+        call == sync_call_fdatasync ? "fdatasync" : "sync_file_range");
+    return -1;
+  }
+
+  lat_hist_add(hist, ELAPSED_NS(start, stop));
+  return ELAPSED_NS(start, stop);
+}
+
+// A region of the target that could not be written
+struct bad_region {
+  off_t offset;
+  off_t len;
+  int err;
+  int iter;
+};
+
+// Map of bad regions, optionally kept in a file so that it persists across
+// runs
+struct bad_map {
+  const char * path;
+  struct bad_region * regions;
+  uint64_t n;
+  uint64_t max;
+  uint64_t errors;    // Bad regions found by this run
+  uint64_t recovered; // Chunks written successfully on a retry
+  uint64_t skipped;   // Chunks skipped because they are in a bad region
+};
+
+// Loads the bad regions of map->path, which may not exist yet.  Each line of
+// the file holds the offset, length, errno and iteration of one region.
+// Returns 0 on success or -1 on error.
+int bad_map_load(struct bad_map * map)
+{
+  FILE * f;
+  char line[256];
+  struct bad_region r;
+
+  f = fopen(map->path, "r");
+  if(!f) {
+    if(errno == ENOENT) {
+      return 0;
+    }
+    perror(map->path);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    if(line[0] == '#' || sscanf(line, "%ld %ld %d %d", &r.offset, &r.len,
+          &r.err, &r.iter) != 4) {
+      continue;
+    }
+    if(map->n == map->max) {
+      map->max = map->max ? 2 * map->max : 64;
+      map->regions = realloc(map->regions, map->max * sizeof(r));
+      if(!map->regions) {
+        perror("realloc[bad_map]");
+        fclose(f);
+        return -1;
+      }
+    }
+    map->regions[map->n++] = r;
+  }
+  fclose(f);
+
+  return 0;
+}
+
+// Adds a bad region to map and appends it to map->path, if any.  Returns 0
+// on success or -1 on error.
+int bad_map_add(struct bad_map * map, off_t offset, off_t len, int err,
+    int iter)
+{
+  FILE * f;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
+
+  if(map->n == map->max) {
+    map->max = map->max ? 2 * map->max : 64;
+    map->regions = realloc(map->regions, map->max * sizeof(*map->regions));
+    if(!map->regions) {
+      perror("realloc[bad_map]");
+      return -1;
+    }
+  }
+  map->regions[map->n].offset = offset;
+  map->regions[map->n].len = len;
+  map->regions[map->n].err = err;
+  map->regions[map->n].iter = iter;
+  map->n++;
+  map->errors++;
+
+  if(map->path) {
+    f = fopen(map->path, "a");
+    if(!f) {
+      perror(map->path);
+      return -1;
+    }
+    time(&now);
+    strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+    fprintf(f, "%ld %ld %d %d # %s %s\n", offset, len, err, iter,
+        strnow, strerror(err));
+    if(fflush(f) || fsync(fileno(f)) || fclose(f)) {
+      perror(map->path);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Returns the offset of the first bad region of map that ends after offset,
+// or -1 if there is none.  The region may start before offset.
+off_t bad_map_next(const struct bad_map * map, off_t offset)
+{
+  uint64_t k;
+  off_t next = -1;
+
+  for(k=0; k<map->n; k++) {
+    if(map->regions[k].offset + map->regions[k].len > offset &&
+        (next == -1 || map->regions[k].offset < next)) {
+      next = map->regions[k].offset;
+    }
+  }
+
+  return next;
+}
+
+// Optional behavior of write_pass.  The caller sets the policy fields,
+// write_pass maintains the state and totals.
+struct write_ctl {
+  // Chunks per call, 0 for as many as possible
+  uint64_t max_iovs;
+  // Sync cadence: sync after every sync_every chunks
+  enum sync_mode sync_mode;
+  uint64_t sync_every;
+  enum sync_call sync_call;
+  struct lat_hist * sync_hist;
+  // Write-behind: start writeback of every wb_window chunks and wait for
+  // the window wb_lag windows back, optionally dropping its pages
+  uint64_t wb_window;
+  int wb_lag;
+  int wb_drop;
+  struct lat_hist * wb_hist;
+  // Totals for the current pass
+  uint64_t nsyncs;
+  int64_t sync_ns;
+  int64_t wb_ns;
+  // State
+  uint64_t since_sync;
+  off_t synced;
+  uint64_t since_wb;
+  off_t wb_started;
+  off_t wb_waited;
+  // Error tolerance: failed chunks are retried retries times, retry_delay
+  // seconds apart, then added to bad.  Writes fail once more than
+  // error_budget chunks are bad.  Chunks in known bad regions are skipped.
+  struct bad_map * bad;
+  int retries;
+  double retry_delay;
+  uint64_t error_budget;
+};
+
+// Writes nchunks chunks of piov to fd at pos one chunk at a time, retrying
+// chunks that fail.  Chunks that still fail are added to the bad region map
+// and skipped.  Returns 0 on success or -1 on error, including exhausting the
+// error budget.
+int write_tolerant(int fd, struct iovec * piov, uint64_t nchunks,
+    size_t chunk_size, off_t pos, int iter, struct write_ctl * ctl)
+{
+  uint64_t k;
+  int attempt;
+  int err = 0;
+  ssize_t rc;
+  struct timespec start;
+  struct timespec delay;
+
+  delay.tv_sec = ctl->retry_delay;
+  delay.tv_nsec = (ctl->retry_delay - delay.tv_sec) * 1e9;
+
+  for(k=0; k<nchunks; k++) {
+    for(attempt=0; ; attempt++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      wd_begin(0, &start);
+      rc = pwritev(fd, &piov[k], 1, pos + k * chunk_size);
+      wd_end(0);
+      if(rc == chunk_size) {
+        break;
+      }
+      // A short write of a single chunk is treated as an I/O error
+      err = (rc == -1) ? errno : EIO;
+      if(attempt == ctl->retries) {
+        break;
+      }
+      nanosleep(&delay, NULL);
+    }
+
+    if(rc == chunk_size) {
+      ctl->bad->recovered += (attempt > 0);
+      continue;
+    }
+
+    printf("error: iter %d offset %ld: %s after %d retries\n", iter,
+        pos + k * chunk_size, strerror(err), ctl->retries);
+    if(bad_map_add(ctl->bad, pos + k * chunk_size, chunk_size, err, iter)) {
+      return -1;
+    }
+    if(ctl->bad->errors > ctl->error_budget) {
+      printf("error: error budget of %lu exhausted\n", ctl->error_budget);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Waits for writeback of len bytes at offset of fd to complete, then drops
+// them from the page cache if ctl->wb_drop is set.  Returns 0 on success or
+// -1 on error.
+int write_behind_wait(int fd, struct write_ctl * ctl, off_t offset, off_t len)
+{
+  int rc;
+  struct timespec start, stop;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  wd_begin(0, &start);
+  rc = sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+        SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  wd_end(0);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if(rc) {
+    perror("sync_file_range");
+    return -1;
+  }
+  lat_hist_add(ctl->wb_hist, ELAPSED_NS(start, stop));
+  ctl->wb_ns += ELAPSED_NS(start, stop);
+
+  if(ctl->wb_drop &&
+      (errno = posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED))) {
+    perror("posix_fadvise");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Starts writeback of the data between the last window boundary and pos,
+// then waits for windows until no more than wait_lag windows are still in
+// flight.  Returns 0 on success or -1 on error.
+int write_behind(int fd, struct write_ctl * ctl, off_t pos, off_t window,
+    int wait_lag)
+{
+  off_t len;
+
+  if(pos > ctl->wb_started) {
+    if(sync_file_range(fd, ctl->wb_started, pos - ctl->wb_started,
+          SYNC_FILE_RANGE_WRITE)) {
+      perror("sync_file_range");
+      return -1;
+    }
+    ctl->wb_started = pos;
+  }
+  ctl->since_wb = 0;
+
+  while(pos - ctl->wb_waited > wait_lag * window) {
+    len = pos - ctl->wb_waited;
+    if(len > window) {
+      len = window;
+    }
+    if(write_behind_wait(fd, ctl, ctl->wb_waited, len)) {
+      return -1;
+    }
+    ctl->wb_waited += len;
+  }
+
+  return 0;
+}
+
+// Writes nchunks chunks described by the iovec array starting at piov to fd,
+// starting at the current file offset.  Each call to writev is timed and
+// added to hist, if non-NULL.  If ctl is non-NULL, its policies are applied
+// between calls to writev.  Returns 0 on success or -1 on error after
+// displaying diagnostics.
+int write_pass(int fd, struct iovec * piov, uint64_t nchunks,
+    size_t chunk_size, int iter, struct lat_hist * hist,
+    struct write_ctl * ctl)
+{
+  uint64_t iovs_remaining;
+  uint64_t iovs_to_write;
+  ssize_t bytes_written;
+  ssize_t bytes_written_partial;
+  int err;
+  off_t pos = 0;
+  off_t next_bad;
+  int64_t ns;
+  struct timespec start, stop;
+
+  if(ctl) {
+    pos = lseek(fd, 0, SEEK_CUR);
+    ctl->since_sync = 0;
+    ctl->synced = pos;
+    ctl->nsyncs = 0;
+    ctl->sync_ns = 0;
+    ctl->since_wb = 0;
+    ctl->wb_started = pos;
+    ctl->wb_waited = pos;
+    ctl->wb_ns = 0;
+  }
+
+  iovs_remaining = nchunks;
+  while(iovs_remaining > 0) {
+    // Skip chunks in known bad regions
+    next_bad = -1;
+    if(ctl && ctl->bad) {
+      while(iovs_remaining > 0 &&
+          (next_bad = bad_map_next(ctl->bad, pos)) != -1 &&
+          next_bad < pos + (off_t)chunk_size) {
+        piov++;
+        iovs_remaining--;
+        pos += chunk_size;
+        ctl->bad->skipped++;
+      }
+      if(iovs_remaining == 0) {
+        break;
+      }
+    }
+
+    // The number of iovecs that can be written in one call to writev is
+    // limited to IOV_MAX.
+    iovs_to_write = (iovs_remaining > IOV_MAX) ? IOV_MAX : iovs_remaining;
+
+    // Furthermore, the total number of bytes written must not exceed
+    // SSIZE_MAX, the maximum value of ssize_t (signed size_t).  This means
+    // we have to loop through iovs in case file_chunks is greater than
+    // IOV_MAX or if IOVMAX (or fewer) iovs will exceed SSIZE_MAX.
+    if(iovs_to_write * chunk_size > (size_t)SSIZE_MAX) {
+      iovs_to_write = (size_t)SSIZE_MAX / chunk_size;
+    }
+
+    // Do not write past the next sync point or write-behind window
+    if(ctl && ctl->sync_every &&
+        iovs_to_write > ctl->sync_every - ctl->since_sync) {
+      iovs_to_write = ctl->sync_every - ctl->since_sync;
+    }
+    if(ctl && ctl->wb_window &&
+        iovs_to_write > ctl->wb_window - ctl->since_wb) {
+      iovs_to_write = ctl->wb_window - ctl->since_wb;
+    }
+    if(ctl && ctl->max_iovs && iovs_to_write > ctl->max_iovs) {
+      iovs_to_write = ctl->max_iovs;
+    }
+    if(next_bad != -1 && iovs_to_write > (next_bad - pos) / chunk_size) {
+      iovs_to_write = (next_bad - pos) / chunk_size;
+    }
+    if(iovs_to_write > pace_batch(chunk_size)) {
+      iovs_to_write = pace_batch(chunk_size);
+    }
+    pace(iovs_to_write * chunk_size);
+
+    // Write data.  In tolerant mode, writes go to explicit offsets so that
+    // failed chunks can be rewritten individually and then skipped.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wd_begin(0, &start);
+    if(ctl && ctl->bad) {
+      bytes_written = pwritev(fd, piov, iovs_to_write, pos);
+    } else {
+      bytes_written = writev(fd, piov, iovs_to_write);
+    }
+    wd_end(0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if(ctl && ctl->bad && (bytes_written == -1 ||
+          bytes_written < (ssize_t)(iovs_to_write * chunk_size))) {
+      // Rewrite whatever was not written one chunk at a time
+      if(bytes_written == -1) {
+        bytes_written = 0;
+      }
+      if(write_tolerant(fd, piov + bytes_written / chunk_size,
+            iovs_to_write - bytes_written / chunk_size, chunk_size,
+            pos + bytes_written / chunk_size * chunk_size, iter, ctl)) {
+        return -1;
+      }
+      bytes_written = iovs_to_write * chunk_size;
+    } else if(bytes_written == -1) {
+      // Error.  Running out of space is expected by some callers, so errno
+      // is preserved and the detailed diagnostics are skipped for ENOSPC.
+      err = errno;
+      perror("writev");
+      if(err != ENOSPC) {
+        fprintf(stderr, "iter %d iovs_remaining %ld iovs_to_write %ld\n",
+            iter, iovs_remaining, iovs_to_write);
+        fprintf(stderr, "piov %p iov_base %p iov_len %lu\n",
+            piov, piov->iov_base, piov->iov_len);
+      }
+      errno = err;
+      return -1;
+    }
+    if(hist) {
+      lat_hist_add(hist, ELAPSED_NS(start, stop));
+    }
+    if(bytes_written < iovs_to_write * chunk_size) {
+      // Incomplete write
+      // Set iovs_to_write to the number of complete iovs written.
+      iovs_to_write = bytes_written / chunk_size;
+      // Set bytes_written_partial to number of bytes written from next iov
+      bytes_written_partial = bytes_written % chunk_size;
+      // If any bytes were written from the next iov
+      if(bytes_written_partial > 0) {
+        // Increment iov pointer, decrement iov length
+        piov[iovs_to_write].iov_base += bytes_written_partial;
+        piov[iovs_to_write].iov_len  -= bytes_written_partial;
+        // Write remainder of partially written iov
+        if((bytes_written = writev(fd, &piov[iovs_to_write], 1)) == -1) {
+          // Error
+          perror("writev[partal]");
+          return -1;
+        } else if(bytes_written < chunk_size - bytes_written_partial) {
+          printf("error: double incomplete writes not supported\n");
+          return -1;
+        }
+        // Increment iov pointer, decrement iov length
+        piov[iovs_to_write].iov_base -= bytes_written_partial;
+        piov[iovs_to_write].iov_len  += bytes_written_partial;
+        iovs_to_write++;
+      }
+    }
+
+    // Increment iovs pointer and iovs remaining basond on iovs_to_write
+    piov += iovs_to_write;
+    iovs_remaining -= iovs_to_write;
+
+    if(!ctl) {
+      continue;
+    }
+    pos += iovs_to_write * chunk_size;
+
+    // Sync if a sync point has been reached
+    if(ctl->sync_every) {
+      ctl->since_sync += iovs_to_write;
+      if(ctl->since_sync >= ctl->sync_every) {
+        if((ns = sync_range(fd, ctl->sync_call, ctl->synced,
+                pos - ctl->synced, ctl->sync_hist)) < 0) {
+          return -1;
+        }
+        ctl->nsyncs++;
+        ctl->sync_ns += ns;
+        ctl->since_sync = 0;
+        ctl->synced = pos;
+      }
+    }
+
+    // Start writeback of each completed window
+    if(ctl->wb_window) {
+      ctl->since_wb += iovs_to_write;
+      if(ctl->since_wb >= ctl->wb_window && write_behind(fd, ctl, pos,
+            ctl->wb_window * chunk_size, ctl->wb_lag)) {
+        return -1;
+      }
+    }
+  }
+
+  // Finish writeback of the whole pass so that it does not spill into the
+  // next iteration
+  if(ctl && ctl->wb_window &&
+      write_behind(fd, ctl, pos, ctl->wb_window * chunk_size, 0)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// Per-direction totals for one pass of the mixed workload
+struct rw_totals {
+  uint64_t bytes;
+  int64_t ns;
+};
+
+// Performs one pass of the mixed read/write workload over the nchunks chunks
+// at the start of fd.  For each chunk, a random choice is made (using the
+// PRNG state in xsubi) to either read it into rbuf or write it from the
+// corresponding iovec of piov, such that rwmix percent of the chunk I/Os are
+// reads.  The time spent in each read and write call is added to the
+// corresponding histogram and totals.  Returns 0 on success or -1 on error.
+int mixed_pass(int fd, struct iovec * piov, uint64_t nchunks,
+    size_t chunk_size, int rwmix, char * rbuf, unsigned short xsubi[3],
+    int iter, struct lat_hist * rhist, struct lat_hist * whist,
+    struct rw_totals * rtot, struct rw_totals * wtot)
+{
+  uint64_t j;
+  off_t offset;
+  ssize_t rc;
+  int is_read;
+  int64_t ns;
+  struct timespec start, stop;
+
+  for(j=0; j<nchunks; j++) {
+    offset = j * chunk_size;
+    is_read = (nrand48(xsubi) % 100) < rwmix;
+
+    pace(chunk_size);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wd_begin(0, &start);
+    if(is_read) {
+      rc = pread(fd, rbuf, chunk_size, offset);
+    } else {
+      rc = pwrite(fd, piov[j].iov_base, chunk_size, offset);
+    }
+    wd_end(0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if(rc != chunk_size) {
+      if(rc == -1) {
+        perror(is_read ? "pread" : "pwrite");
+      } else {
+        printf("error: short %s of %ld bytes\n",
+            is_read ? "read" : "write", rc);
+      }
+      fprintf(stderr, "iter %d chunk %lu offset %ld\n", iter, j, offset);
+      return -1;
+    }
+
+    ns = ELAPSED_NS(start, stop);
+    if(is_read) {
+      lat_hist_add(rhist, ns);
+      rtot->bytes += chunk_size;
+      rtot->ns += ns;
+    } else {
+      lat_hist_add(whist, ns);
+      wtot->bytes += chunk_size;
+      wtot->ns += ns;
+    }
+  }
+
+  return 0;
+}
+
+// State for verifying data read back from a file written by disk_hammer.
+// Chunk j of the file is expected to hold unique chunk (rot + j) % count,
+// where rot is the starting chunk used by the iteration that wrote the file.
+// Since that iteration is unknown, rot is deduced from the first chunk
+// verified and all other chunks are checked against it.
+struct verify_state {
+  const char * buffer;
+  int alignment;
+  size_t chunk_size;
+  uint32_t chunk_count;
+  int rot; // -1 until deduced
+  uint64_t errors;
+};
+
+// Maximum number of mismatches displayed per verify_state
+#define VERIFY_MAX_REPORTS 10
+
+// Verifies that data holds the expected contents of chunk j.  Returns 0 if
+// it does, otherwise displays a diagnostic and returns -1.
+int verify_chunk(struct verify_state * v, const char * data, uint64_t j,
+    int iter)
+{
+  int k;
+
+  if(v->rot < 0) {
+    for(k=0; k<v->chunk_count; k++) {
+      if(!memcmp(data, v->buffer + k*v->alignment, v->chunk_size)) {
+        v->rot = (k + v->chunk_count - j % v->chunk_count) % v->chunk_count;
+        return 0;
+      }
+    }
+  } else {
+    k = (v->rot + j) % v->chunk_count;
+    if(!memcmp(data, v->buffer + k*v->alignment, v->chunk_size)) {
+      return 0;
+    }
+  }
+
+  if(v->errors++ < VERIFY_MAX_REPORTS) {
+    printf("verify error: iter %d chunk %lu offset %lu does not match %s\n",
+        iter, j, j * v->chunk_size,
+        v->rot < 0 ? "any unique chunk" : "expected chunk");
+  }
+  return -1;
+}
+
+// Reads nchunks chunks from the start of fd into rbuf, which must hold at
+// least batch chunks, using calls to readv of up to batch chunks each.  Each
+// call to readv is timed and added to hist.  If v is non-NULL, each chunk is
+// verified after it is read.  Returns 0 on success or -1 on error.
+int read_pass(int fd, char * rbuf, uint64_t batch, uint64_t nchunks,
+    size_t chunk_size, int iter, struct lat_hist * hist,
+    struct verify_state * v)
+{
+  uint64_t j;
+  uint64_t k;
+  uint64_t iovs_to_read;
+  size_t bytes_wanted;
+  ssize_t bytes_read;
+  ssize_t rc;
+  off_t offset;
+  struct iovec iovs[IOV_MAX];
+  struct timespec start, stop;
+
+  for(j=0; j<nchunks; j+=iovs_to_read) {
+    iovs_to_read = (nchunks - j > batch) ? batch : nchunks - j;
+    if(iovs_to_read > pace_batch(chunk_size)) {
+      iovs_to_read = pace_batch(chunk_size);
+    }
+    for(k=0; k<iovs_to_read; k++) {
+      iovs[k].iov_base = rbuf + k * chunk_size;
+      iovs[k].iov_len = chunk_size;
+    }
+    bytes_wanted = iovs_to_read * chunk_size;
+    offset = j * chunk_size;
+
+    pace(bytes_wanted);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wd_begin(0, &start);
+    bytes_read = readv(fd, iovs, iovs_to_read);
+    wd_end(0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if(bytes_read == -1) {
+      perror("readv");
+      fprintf(stderr, "iter %d offset %ld bytes %lu\n",
+          iter, offset, bytes_wanted);
+      return -1;
+    }
+    lat_hist_add(hist, ELAPSED_NS(start, stop));
+
+    // The iovecs cover rbuf contiguously, so an incomplete read can be
+    // finished with plain reads into the remainder of rbuf.
+    while(bytes_read < bytes_wanted) {
+      rc = read(fd, rbuf + bytes_read, bytes_wanted - bytes_read);
+      if(rc == -1) {
+        perror("read[partial]");
+        return -1;
+      } else if(rc == 0) {
+        printf("error: %s ends at offset %ld, before LENGTH\n",
+            "file", offset + bytes_read);
+        return -1;
+      }
+      bytes_read += rc;
+    }
+
+    if(v) {
+      for(k=0; k<iovs_to_read; k++) {
+        verify_chunk(v, rbuf + k * chunk_size, j + k, iter);
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Discards len bytes at offset of fd.  Block devices are discarded with the
+// BLKDISCARD ioctl, other files have a hole punched in them.  The time taken
+// is added to hist, if non-NULL.  Returns 0 on success or -1 on error.
+int discard_range(int fd, int is_blk, off_t offset, off_t len,
+    struct lat_hist * hist)
+{
+  uint64_t range[2] = {offset, len};
+  int rc;
+  struct timespec start, stop;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  wd_begin(0, &start);
+  if(is_blk) {
+    rc = ioctl(fd, BLKDISCARD, &range);
+  } else {
+    rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        offset, len);
+  }
+  wd_end(0);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if(rc == -1) {
+    perror(is_blk ? "ioctl[BLKDISCARD]" : "fallocate[PUNCH_HOLE]");
+    return -1;
+  }
+
+  if(hist) {
+    lat_hist_add(hist, ELAPSED_NS(start, stop));
+  }
+  return 0;
+}
+
+// Discards fraction of the nchunks chunks at the start of filename.  The
+// discarded chunks form a contiguous range (wrapping around to the start of
+// the target region) that begins at a chunk chosen at random using the PRNG
+// state in xsubi.  The bytes discarded and total time taken (including
+// opening and closing filename) are stored in tot.  Returns 0 on success or
+// -1 on error.
+int discard_pass(const char * filename, uint64_t nchunks, size_t chunk_size,
+    double fraction, unsigned short xsubi[3], struct lat_hist * hist,
+    struct rw_totals * tot)
+{
+  int fd;
+  int is_blk;
+  uint64_t first;
+  uint64_t count;
+  uint64_t tail;
+  struct stat st;
+  struct timespec start, stop;
+
+  count = fraction * nchunks + 0.5;
+  if(count == 0) {
+    count = 1;
+  }
+  first = (count < nchunks) ? nrand48(xsubi) % nchunks : 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  fd = open(filename, O_WRONLY);
+  if(fd == -1) {
+    perror(filename);
+    return -1;
+  }
+  if(fstat(fd, &st) == -1) {
+    perror("fstat");
+    return -1;
+  }
+  is_blk = S_ISBLK(st.st_mode);
+
+  // Discard from first to end of target region, then wrap if needed
+  tail = (first + count > nchunks) ? first + count - nchunks : 0;
+  if(discard_range(fd, is_blk, first * chunk_size,
+        (count - tail) * chunk_size, hist)) {
+    return -1;
+  }
+  if(tail > 0 && discard_range(fd, is_blk, 0, tail * chunk_size, hist)) {
+    return -1;
+  }
+
+  if(close(fd) == -1) {
+    perror("close");
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  tot->bytes = count * chunk_size;
+  tot->ns = ELAPSED_NS(start, stop);
+
+  return 0;
+}
+
+// State shared by the committer threads of the WAL workload.  Each committer
+// claims the next record (and its offset) by incrementing next_record, writes
+// it and then waits for it to become durable.  With fdatasync, committers
+// share syncs (group commit): the first committer to find no sync in progress
+// becomes the leader and syncs on behalf of every record whose write has
+// completed, while the others wait for a sync that covers their record.
+struct wal_state {
+  int fd;
+  enum wal_sync method;
+  const char * buffer;
+  int alignment;
+  uint32_t chunk_count;
+  size_t record_size;
+  uint64_t nrecords;
+  uint64_t next_record;
+  int error;
+  pthread_mutex_t lock;
+  pthread_cond_t synced;
+  uint64_t written;  // Number of records whose writes have completed
+  uint64_t durable;  // Number of completed writes covered by a sync
+  int syncing;
+  uint64_t nsyncs;
+};
+
+// Per-committer state
+struct wal_committer {
+  pthread_t thread;
+  struct wal_state * ws;
+  struct lat_hist hist;
+};
+
+static void * wal_committer_main(void * arg)
+{
+  struct wal_committer * wc = arg;
+  struct wal_state * ws = wc->ws;
+  uint64_t r;
+  uint64_t ticket;
+  uint64_t target;
+  ssize_t rc;
+  struct iovec iov;
+  struct timespec start, stop;
+
+  while(!__atomic_load_n(&ws->error, __ATOMIC_RELAXED) &&
+      (r = __atomic_fetch_add(&ws->next_record, 1, __ATOMIC_RELAXED))
+        < ws->nrecords) {
+    iov.iov_base = (char *)ws->buffer + (r % ws->chunk_count) * ws->alignment;
+    iov.iov_len = ws->record_size;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(ws->method == wal_sync_rwf_dsync) {
+      rc = pwritev2(ws->fd, &iov, 1, r * ws->record_size, RWF_DSYNC);
+    } else {
+      rc = pwritev(ws->fd, &iov, 1, r * ws->record_size);
+    }
+    if(rc != ws->record_size) {
+      if(rc == -1) {
+        perror("pwritev[wal]");
+      } else {
+        printf("error: short wal write of %ld bytes\n", rc);
+      }
+      __atomic_store_n(&ws->error, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    if(ws->method == wal_sync_fdatasync) {
+      pthread_mutex_lock(&ws->lock);
+      ticket = ++ws->written;
+      while(ws->durable < ticket && !ws->error) {
+        if(ws->syncing) {
+          pthread_cond_wait(&ws->synced, &ws->lock);
+          continue;
+        }
+        // Become the leader for a sync covering all completed writes
+        ws->syncing = 1;
+        target = ws->written;
+        pthread_mutex_unlock(&ws->lock);
+        rc = fdatasync(ws->fd);
+        pthread_mutex_lock(&ws->lock);
+        if(rc == -1) {
+          perror("fdatasync[wal]");
+          ws->error = 1;
+        }
+        ws->durable = target;
+        ws->syncing = 0;
+        ws->nsyncs++;
+        pthread_cond_broadcast(&ws->synced);
+      }
+      pthread_mutex_unlock(&ws->lock);
+    } else {
+      __atomic_fetch_add(&ws->nsyncs, 1, __ATOMIC_RELAXED);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    lat_hist_add(&wc->hist, ELAPSED_NS(start, stop));
+  }
+
+  return NULL;
+}
+
+// Appends nrecords records of record_size bytes to the (empty) file fd using
+// ncommitters committer threads, making each record durable before it is
+// considered committed.  Commit latencies (from start of write until durable)
+// are added to hist and the number of syncs performed is stored in nsyncs.
+// Returns 0 on success or -1 on error.
+int wal_pass(int fd, enum wal_sync method, const char * buffer,
+    int alignment, uint32_t chunk_count, size_t record_size,
+    uint64_t nrecords, int ncommitters, struct lat_hist * hist,
+    uint64_t * nsyncs)
+{
+  int i;
+  int rc = 0;
+  struct wal_committer * wcs;
+  struct wal_state ws = {
+    .fd = fd,
+    .method = method,
+    .buffer = buffer,
+    .alignment = alignment,
+    .chunk_count = chunk_count,
+    .record_size = record_size,
+    .nrecords = nrecords,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .synced = PTHREAD_COND_INITIALIZER
+  };
+
+  wcs = calloc(ncommitters, sizeof(*wcs));
+  if(!wcs) {
+    perror("calloc[wal_committer]");
+    return -1;
+  }
+
+  for(i=0; i<ncommitters; i++) {
+    wcs[i].ws = &ws;
+    if((errno = pthread_create(&wcs[i].thread, NULL, wal_committer_main,
+            &wcs[i]))) {
+      perror("pthread_create");
+      ws.error = 1;
+      ncommitters = i;
+      rc = -1;
+      break;
+    }
+  }
+
+  for(i=0; i<ncommitters; i++) {
+    pthread_join(wcs[i].thread, NULL);
+    lat_hist_merge(hist, &wcs[i].hist);
+  }
+
+  *nsyncs = ws.nsyncs;
+  free(wcs);
+
+  return (rc || ws.error) ? -1 : 0;
+}
+
+// Per-operation latency histograms for the metadata workload
+struct meta_hists {
+  struct lat_hist create;
+  struct lat_hist write;
+  struct lat_hist fsync;
+  struct lat_hist unlink;
+};
+
+// State shared by the threads of the metadata workload
+struct meta_state {
+  const char * dirname;
+  const char * buffer;
+  int alignment;
+  uint32_t chunk_count;
+  size_t file_size;
+  int width;
+  int depth;
+  int fsync;
+  int unlink;
+  int stale; // Files may be left from an earlier pass or run
+  uint64_t nfiles;
+  uint64_t next_file;
+  int error;
+};
+
+// Per-thread state
+struct meta_thread {
+  pthread_t thread;
+  struct meta_state * ms;
+  struct meta_hists hists;
+};
+
+// Formats the path of file k of the metadata workload into path.  The
+// directory of file k is chosen by taking successive base-width digits of k,
+// so consecutive files land in different directories.
+static void meta_path(char * path, size_t len, const struct meta_state * ms,
+    uint64_t k)
+{
+  int l;
+  int n;
+  uint64_t idx = k;
+
+  n = snprintf(path, len, "%s", ms->dirname);
+  for(l=0; l<ms->depth && ms->width > 0; l++) {
+    n += snprintf(path+n, len-n, "/%02lx", idx % ms->width);
+    idx /= ms->width;
+  }
+  snprintf(path+n, len-n, "/f%08lu", k);
+}
+
+// Creates the fanout directory tree below path, depth levels deep with width
+// subdirectories per level.  Returns 0 on success or -1 on error.
+int meta_mkdirs(char * path, size_t len, int width, int depth)
+{
+  int i;
+  int n;
+
+  if(mkdir(path, 0777) == -1 && errno != EEXIST) {
+    perror(path);
+    return -1;
+  }
+  if(depth == 0) {
+    return 0;
+  }
+
+  n = strlen(path);
+  for(i=0; i<width; i++) {
+    snprintf(path+n, len-n, "/%02x", i);
+    if(meta_mkdirs(path, len, width, depth-1)) {
+      return -1;
+    }
+  }
+  path[n] = '\0';
+
+  return 0;
+}
+
+// Times the result of an expression into hist, bailing out of the loop on
+// failure.
+#define META_TIMED(hist, expr, what) \
+  clock_gettime(CLOCK_MONOTONIC, &start); \
+  rc = (expr); \
+  clock_gettime(CLOCK_MONOTONIC, &stop); \
+  if(rc == -1) { \
+    perror(what); \
+    fprintf(stderr, "file %s\n", path); \
+    __atomic_store_n(&ms->error, 1, __ATOMIC_RELAXED); \
+    if(fd != -1) { \
+      close(fd); \
+    } \
+    break; \
+  } \
+  lat_hist_add(hist, ELAPSED_NS(start, stop))
+
+static void * meta_thread_main(void * arg)
+{
+  struct meta_thread * mt = arg;
+  struct meta_state * ms = mt->ms;
+  uint64_t k;
+  int fd;
+  ssize_t rc;
+  char path[PATH_MAX];
+  struct timespec start, stop;
+
+  while(!__atomic_load_n(&ms->error, __ATOMIC_RELAXED) &&
+      (k = __atomic_fetch_add(&ms->next_file, 1, __ATOMIC_RELAXED))
+        < ms->nfiles) {
+    meta_path(path, sizeof(path), ms, k);
+
+    // A file left by an earlier pass is removed (untimed) so that the
+    // create below really creates a file
+    fd = -1;
+    if(ms->stale && unlink(path) == -1 && errno != ENOENT) {
+      perror("unlink");
+      __atomic_store_n(&ms->error, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    META_TIMED(&mt->hists.create,
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666), "open");
+    META_TIMED(&mt->hists.write,
+        pwrite(fd, ms->buffer + (k % ms->chunk_count) * ms->alignment,
+          ms->file_size, 0), "pwrite");
+    if(rc != ms->file_size) {
+      printf("error: short write of %ld bytes to %s\n", rc, path);
+      __atomic_store_n(&ms->error, 1, __ATOMIC_RELAXED);
+      close(fd);
+      break;
+    }
+    if(ms->fsync) {
+      META_TIMED(&mt->hists.fsync, fsync(fd), "fsync");
+    }
+    rc = close(fd);
+    fd = -1;
+    if(rc == -1) {
+      perror("close");
+      __atomic_store_n(&ms->error, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    if(ms->unlink) {
+      META_TIMED(&mt->hists.unlink, unlink(path), "unlink");
+    }
+  }
+
+  return NULL;
+}
+
+// Creates nfiles files of file_size bytes below dirname using nthreads
+// threads.  Each file is written with one chunk of data, optionally fsynced
+// and optionally unlinked after it has been closed.  If stale is set, files
+// left by an earlier pass or run are unlinked before they are created again.
+// Latencies of each operation are added to the corresponding histogram in
+// hists.  Returns 0 on success or -1 on error.
+int meta_pass(const char * dirname, const char * buffer, int alignment,
+    uint32_t chunk_count, size_t file_size, int width, int depth,
+    int fsync, int unlink, int stale, uint64_t nfiles, int nthreads,
+    struct meta_hists * hists)
+{
+  int i;
+  int rc = 0;
+  struct meta_thread * mts;
+  struct meta_state ms = {
+    .dirname = dirname,
+    .buffer = buffer,
+    .alignment = alignment,
+    .chunk_count = chunk_count,
+    .file_size = file_size,
+    .width = width,
+    .depth = depth,
+    .fsync = fsync,
+    .unlink = unlink,
+    .stale = stale,
+    .nfiles = nfiles
+  };
+
+  mts = calloc(nthreads, sizeof(*mts));
+  if(!mts) {
+    perror("calloc[meta_thread]");
+    return -1;
+  }
+
+  for(i=0; i<nthreads; i++) {
+    mts[i].ms = &ms;
+    if((errno = pthread_create(&mts[i].thread, NULL, meta_thread_main,
+            &mts[i]))) {
+      perror("pthread_create");
+      ms.error = 1;
+      nthreads = i;
+      rc = -1;
+      break;
+    }
+  }
+
+  for(i=0; i<nthreads; i++) {
+    pthread_join(mts[i].thread, NULL);
+    lat_hist_merge(&hists->create, &mts[i].hists.create);
+    lat_hist_merge(&hists->write, &mts[i].hists.write);
+    lat_hist_merge(&hists->fsync, &mts[i].hists.fsync);
+    lat_hist_merge(&hists->unlink, &mts[i].hists.unlink);
+  }
+
+  free(mts);
+
+  return (rc || ms.error) ? -1 : 0;
+}
+
+// Block device I/O statistics from /proc/diskstats
+struct dh_diskstats {
+  uint64_t reads;
+  uint64_t sectors_read;
+  uint64_t writes;
+  uint64_t sectors_written;
+  uint64_t in_flight;
+  uint64_t io_ticks_ms;
+};
+
+// Reads the /proc/diskstats entry for the device dev into ds.  Returns 0 on
+// success or -1 if the device has no entry (e.g. for network or virtual
+// filesystems).
+int read_diskstats(dev_t dev, struct dh_diskstats * ds)
+{
+  FILE * f;
+  unsigned int maj, min;
+  int rc = -1;
+  char line[512];
+
+  f = fopen("/proc/diskstats", "r");
+  if(!f) {
+    return -1;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%u %u %*s %lu %*u %lu %*u %lu %*u %lu %*u %lu %lu",
+          &maj, &min, &ds->reads, &ds->sectors_read, &ds->writes,
+          &ds->sectors_written, &ds->in_flight, &ds->io_ticks_ms) == 8 &&
+        maj == major(dev) && min == minor(dev)) {
+      rc = 0;
+      break;
+    }
+  }
+  fclose(f);
+
+  return rc;
+}
+
+// Watchdog settings.  Warnings are shown when the oldest outstanding I/O is
+// warn seconds old and again each time its age doubles.  The process exits
+// with WATCHDOG_EXIT_CODE once it is abort seconds old, unless abort is 0.
+struct watchdog {
+  pthread_t thread;
+  double warn;
+  double abort;
+  dev_t dev;
+};
+
+// Shows the age of the oldest outstanding I/O along with the stats of the
+// device at that moment
+static void watchdog_report(const struct watchdog * wd, const char * what,
+    double age)
+{
+  struct dh_diskstats ds;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
+
+  time(&now);
+  strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+  printf("%s %s: oldest outstanding I/O is %.1f s old", strnow, what, age);
+  if(!read_diskstats(wd->dev, &ds)) {
+    printf(" (device %u:%u in_flight %lu reads %lu writes %lu"
+        " io_ticks %lu ms)\n", major(wd->dev), minor(wd->dev), ds.in_flight,
+        ds.reads, ds.writes, ds.io_ticks_ms);
+  } else {
+    printf(" (device stats unavailable)\n");
+  }
+  fflush(stdout);
+}
+
+static void * watchdog_main(void * arg)
+{
+  struct watchdog * wd = arg;
+  int k;
+  int64_t t;
+  int64_t oldest;
+  int64_t last_oldest = 0;
+  double age;
+  double next_warn = wd->warn;
+  double tick;
+  struct timespec now, sleep;
+
+  // Check several times per threshold, but at least once a second
+  tick = wd->warn / 4;
+  if(wd->abort > 0 && wd->abort / 4 < tick) {
+    tick = wd->abort / 4;
+  }
+  if(tick > 1) {
+    tick = 1;
+  }
+  sleep.tv_sec = tick;
+  sleep.tv_nsec = (tick - sleep.tv_sec) * 1e9;
+
+  for(;;) {
+    nanosleep(&sleep, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    oldest = 0;
+    for(k=0; k<wd_nslots; k++) {
+      t = __atomic_load_n(&wd_slots[k], __ATOMIC_RELAXED);
+      if(t && (!oldest || t < oldest)) {
+        oldest = t;
+      }
+    }
+    if(oldest != last_oldest) {
+      last_oldest = oldest;
+      next_warn = wd->warn;
+    }
+    if(!oldest) {
+      continue;
+    }
+
+    age = (now.tv_sec * 1000000000L + now.tv_nsec - oldest) / 1e9;
+    if(wd->abort > 0 && age >= wd->abort) {
+      watchdog_report(wd, "error", age);
+      printf("error: I/O hung for %.1f s, exiting with status %d\n", age,
+          WATCHDOG_EXIT_CODE);
+      fflush(stdout);
+      _exit(WATCHDOG_EXIT_CODE);
+    } else if(age >= next_warn) {
+      watchdog_report(wd, "warning", age);
+      next_warn *= 2;
+    }
+  }
+
+  return NULL;
+}
+
+// Starts the watchdog thread, tracking nslots I/O slots.  Device stats come
+// from the device holding filename (or its directory, if it does not exist
+// yet), or the device itself.  Returns 0 on success or -1 on error.
+int watchdog_start(struct watchdog * wd, const char * filename, int nslots)
+{
+  struct stat st;
+  char dir[PATH_MAX];
+  char * slash;
+
+  if(stat(filename, &st) == -1) {
+    snprintf(dir, sizeof(dir), "%s", filename);
+    slash = strrchr(dir, '/');
+    if(slash) {
+      slash[slash == dir] = '\0';
+    } else {
+      strcpy(dir, ".");
+    }
+    if(stat(dir, &st) == -1) {
+      perror(dir);
+      return -1;
+    }
+  }
+  wd->dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+  wd_slots = calloc(nslots, sizeof(*wd_slots));
+  if(!wd_slots) {
+    perror("calloc[wd_slots]");
+    return -1;
+  }
+  wd_nslots = nslots;
+
+  if((errno = pthread_create(&wd->thread, NULL, watchdog_main, wd))) {
+    perror("pthread_create[watchdog]");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Performs nrecords buffered writes of random sizes from rmw_min to rmw_max
+// bytes at random (unaligned) offsets within the first file_size bytes of
+// fd, then syncs fd with fdatasync so that the device has written
+// everything.  Data comes from random offsets within the first chunk of
+// buffer.  Write latencies are added to whist and the sync latency to shist.
+// The number of bytes written is stored in *bytes.  Returns 0 on success or
+// -1 on error.
+int rmw_pass(int fd, const char * buffer, size_t chunk_size, size_t file_size,
+    size_t rmw_min, size_t rmw_max, uint64_t nrecords,
+    unsigned short xsubi[3], int iter, struct lat_hist * whist,
+    struct lat_hist * shist, uint64_t * bytes)
+{
+  uint64_t r;
+  size_t len;
+  off_t offset;
+  ssize_t rc;
+  struct timespec start, stop;
+
+  *bytes = 0;
+  for(r=0; r<nrecords; r++) {
+    len = rmw_min + nrand48(xsubi) % (rmw_max - rmw_min + 1);
+    offset = nrand48(xsubi) % (file_size - len + 1);
+
+    pace(len);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wd_begin(0, &start);
+    rc = pwrite(fd, buffer + nrand48(xsubi) % (chunk_size - len + 1), len,
+        offset);
+    wd_end(0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if(rc != len) {
+      if(rc == -1) {
+        perror("pwrite[rmw]");
+      } else {
+        printf("error: short write of %ld bytes\n", rc);
+      }
+      fprintf(stderr, "iter %d record %lu offset %ld len %lu\n",
+          iter, r, offset, len);
+      return -1;
+    }
+    lat_hist_add(whist, ELAPSED_NS(start, stop));
+    *bytes += len;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  wd_begin(0, &start);
+  rc = fdatasync(fd);
+  wd_end(0);
+  if(rc == -1) {
+    perror("fdatasync[rmw]");
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  lat_hist_add(shist, ELAPSED_NS(start, stop));
+
+  return 0;
+}
+
+// Linux native AIO engine.  The AIO system calls are used directly so that
+// libaio is not required.  Each of the depth iocbs has its submission time
+// recorded so that per-I/O latency can be computed at completion.
+static inline int sys_io_setup(unsigned nr, aio_context_t * ctx)
+{
+  return syscall(SYS_io_setup, nr, ctx);
+}
+
+static inline int sys_io_destroy(aio_context_t ctx)
+{
+  return syscall(SYS_io_destroy, ctx);
+}
+
+static inline int sys_io_submit(aio_context_t ctx, long n, struct iocb ** cbs)
+{
+  return syscall(SYS_io_submit, ctx, n, cbs);
+}
+
+static inline int sys_io_getevents(aio_context_t ctx, long min_nr, long nr,
+    struct io_event * events, struct timespec * timeout)
+{
+  return syscall(SYS_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+struct aio_engine {
+  aio_context_t ctx;
+  int depth;
+  int inflight;
+  int nfree;
+  struct iocb * iocbs;
+  struct iocb ** free_iocbs;
+  struct io_event * events;
+  struct timespec * submitted;
+};
+
+// Callback for completed I/Os.  res is the result of the I/O (bytes
+// transferred or negative errno) and lat_ns is the time from submission to
+// reaping.  Returns 0 to continue or -1 to report an error.
+typedef int (*aio_done_fn)(struct iocb * cb, int64_t res, int64_t lat_ns,
+    void * arg);
+
+int aio_engine_init(struct aio_engine * eng, int depth)
+{
+  int i;
+
+  memset(eng, 0, sizeof(*eng));
+  eng->depth = depth;
+  if(sys_io_setup(depth, &eng->ctx)) {
+    perror("io_setup");
+    return -1;
+  }
+
+  eng->iocbs = calloc(depth, sizeof(*eng->iocbs));
+  eng->free_iocbs = calloc(depth, sizeof(*eng->free_iocbs));
+  eng->events = calloc(depth, sizeof(*eng->events));
+  eng->submitted = calloc(depth, sizeof(*eng->submitted));
+  if(!eng->iocbs || !eng->free_iocbs || !eng->events || !eng->submitted) {
+    perror("calloc[aio_engine]");
+    return -1;
+  }
+
+  for(i=0; i<depth; i++) {
+    eng->free_iocbs[i] = &eng->iocbs[depth-1-i];
+  }
+  eng->nfree = depth;
+
+  return 0;
+}
+
+void aio_engine_destroy(struct aio_engine * eng)
+{
+  sys_io_destroy(eng->ctx);
+  free(eng->iocbs);
+  free(eng->free_iocbs);
+  free(eng->events);
+  free(eng->submitted);
+}
+
+// Returns index of iocb cb within the engine
+static inline int aio_engine_slot(const struct aio_engine * eng,
+    const struct iocb * cb)
+{
+  return cb - eng->iocbs;
+}
+
+// Returns an unused iocb prepared for the given I/O or NULL if all iocbs are
+// in flight.
+struct iocb * aio_engine_get(struct aio_engine * eng, int fd, int opcode,
+    void * buf, size_t len, off_t offset, uint64_t data)
+{
+  struct iocb * cb;
+
+  if(eng->nfree == 0) {
+    return NULL;
+  }
+  cb = eng->free_iocbs[--eng->nfree];
+  memset(cb, 0, sizeof(*cb));
+  cb->aio_fildes = fd;
+  cb->aio_lio_opcode = opcode;
+  cb->aio_buf = (uint64_t)buf;
+  cb->aio_nbytes = len;
+  cb->aio_offset = offset;
+  cb->aio_data = data;
+  return cb;
+}
+
+int aio_engine_submit(struct aio_engine * eng, struct iocb * cb)
+{
+  int rc;
+
+  clock_gettime(CLOCK_MONOTONIC, &eng->submitted[aio_engine_slot(eng, cb)]);
+  wd_begin(1 + aio_engine_slot(eng, cb),
+      &eng->submitted[aio_engine_slot(eng, cb)]);
+  while((rc = sys_io_submit(eng->ctx, 1, &cb)) != 1) {
+    if(rc == -1 && errno == EINTR) {
+      continue;
+    }
+    perror("io_submit");
+    return -1;
+  }
+  eng->inflight++;
+  return 0;
+}
+
+// Waits up to timeout (forever if NULL) for at least min_nr I/Os to complete
+// and calls done for each completed I/O.  Returns the number of I/Os reaped
+// or -1 on error.
+int aio_engine_reap_timeout(struct aio_engine * eng, int min_nr,
+    struct timespec * timeout, aio_done_fn done, void * arg)
+{
+  int i;
+  int n;
+  int rc = 0;
+  struct iocb * cb;
+  struct timespec now;
+
+  while((n = sys_io_getevents(eng->ctx, min_nr, eng->depth, eng->events,
+          timeout)) == -1) {
+    if(errno != EINTR) {
+      perror("io_getevents");
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for(i=0; i<n; i++) {
+    cb = (struct iocb *)eng->events[i].obj;
+    wd_end(1 + aio_engine_slot(eng, cb));
+    if(done(cb, eng->events[i].res,
+          ELAPSED_NS(eng->submitted[aio_engine_slot(eng, cb)], now), arg)) {
+      rc = -1;
+    }
+    eng->free_iocbs[eng->nfree++] = cb;
+    eng->inflight--;
+  }
+
+  return rc ? rc : n;
+}
+
+// Waits for at least min_nr I/Os to complete and calls done for each
+// completed I/O.  Returns the number of I/Os reaped or -1 on error.
+int aio_engine_reap(struct aio_engine * eng, int min_nr, aio_done_fn done,
+    void * arg)
+{
+  return aio_engine_reap_timeout(eng, min_nr, NULL, done, arg);
+}
+
+// Adaptive queue depth.  Latencies of completed chunk I/Os are collected in
+// windows of at least DEPTH_CTL_WINDOW_NS and DEPTH_CTL_MIN_SAMPLES I/Os.  At
+// the end of each window the depth grows by one if the window's p99 latency
+// met the target, or is halved if it did not (AIMD).  The converged depth and
+// throughput are moving averages over the windows.
+#ifndef DEPTH_CTL_WINDOW_NS
+#define DEPTH_CTL_WINDOW_NS 100000000L
+#endif
+
+#ifndef DEPTH_CTL_MIN_SAMPLES
+#define DEPTH_CTL_MIN_SAMPLES 100
+#endif
+
+struct depth_ctl {
+  uint64_t target_ns; // p99 latency target
+  int depth;          // Current limit on I/Os in flight
+  int max_depth;
+  int verbose;        // Log every window
+  int64_t start_ns;   // Start of current window
+  int64_t last_ns;    // Last completion
+  uint64_t bytes;     // Bytes completed in current window
+  struct lat_hist window;
+  int nwindows;
+  double avg_depth;
+  double avg_gbps;
+};
+
+static struct depth_ctl * depth_ctl;
+
+// Called after reaping, ends the current window if it is long enough and
+// adjusts the depth.
+static void depth_ctl_step(struct depth_ctl * dc)
+{
+  int64_t now = mono_ns();
+  uint64_t p99;
+  double gbps;
+  int depth = dc->depth;
+
+  dc->last_ns = now;
+  if(now - dc->start_ns < DEPTH_CTL_WINDOW_NS ||
+      dc->window.count < DEPTH_CTL_MIN_SAMPLES) {
+    return;
+  }
+
+  p99 = lat_hist_pct(&dc->window, 99);
+  gbps = 8.0 * dc->bytes / (now - dc->start_ns);
+  if(p99 > dc->target_ns) {
+    dc->depth = depth > 1 ? depth / 2 : 1;
+  } else if(depth < dc->max_depth) {
+    dc->depth = depth + 1;
+  }
+  if(dc->nwindows++ == 0) {
+    dc->avg_depth = depth;
+    dc->avg_gbps = gbps;
+  } else {
+    dc->avg_depth = 0.9 * dc->avg_depth + 0.1 * depth;
+    dc->avg_gbps = 0.9 * dc->avg_gbps + 0.1 * gbps;
+  }
+  if(dc->verbose) {
+    printf("depth %d p99 %lu ns %.3f Gbps -> depth %d\n", depth, p99, gbps,
+        dc->depth);
+  }
+
+  memset(&dc->window, 0, sizeof(dc->window));
+  dc->bytes = 0;
+  dc->start_ns = now;
+}
+
+// State shared with aio_pass_done
+struct aio_pass_state {
+  struct aio_engine * eng;
+  size_t chunk_size;
+  int is_read;
+  int iter;
+  struct lat_hist * hist;
+  struct verify_state * verify;
+};
+
+static int aio_pass_done(struct iocb * cb, int64_t res, int64_t lat_ns,
+    void * arg)
+{
+  struct aio_pass_state * ps = arg;
+
+  if(res != ps->chunk_size) {
+    if(res < 0) {
+      fprintf(stderr, "%s: %s\n", ps->is_read ? "aio read" : "aio write",
+          strerror(-res));
+    } else {
+      printf("error: short %s of %ld bytes\n",
+          ps->is_read ? "read" : "write", res);
+    }
+    fprintf(stderr, "iter %d chunk %llu offset %lld\n",
+        ps->iter, cb->aio_data, cb->aio_offset);
+    return -1;
+  }
+
+  lat_hist_add(ps->hist, lat_ns);
+  if(depth_ctl) {
+    lat_hist_add(&depth_ctl->window, lat_ns);
+    depth_ctl->bytes += res;
+  }
+  if(ps->verify) {
+    verify_chunk(ps->verify, (char *)cb->aio_buf, cb->aio_data, ps->iter);
+  }
+  return 0;
+}
+
+// Reads or writes nchunks chunks at offset base of fd using eng, keeping up
+// to eng->depth chunk I/Os in flight.  Writes come from the iovec array
+// starting at piov.  Reads land in rbuf, which must hold eng->depth chunks,
+// and are verified using v if it is non-NULL.  Returns 0 on success or -1 on
+// error.
+int aio_pass(struct aio_engine * eng, int fd, int is_read, off_t base,
+    struct iovec * piov, uint64_t nchunks, size_t chunk_size, char * rbuf,
+    int iter, struct lat_hist * hist, struct verify_state * v)
+{
+  uint64_t j = 0;
+  void * buf;
+  struct iocb * cb;
+  int64_t delay = 0;
+  struct timespec timeout;
+  struct aio_pass_state ps = {
+    .eng = eng,
+    .chunk_size = chunk_size,
+    .is_read = is_read,
+    .iter = iter,
+    .hist = hist,
+    .verify = v
+  };
+
+  // Time between passes does not count towards the depth control window
+  if(depth_ctl) {
+    depth_ctl->start_ns += mono_ns() - depth_ctl->last_ns;
+  }
+
+  while(j < nchunks || eng->inflight > 0) {
+    // Fill the queue, as far as the depth and rate limits allow
+    while(j < nchunks && eng->nfree > 0 &&
+        (!depth_ctl || eng->inflight < depth_ctl->depth) &&
+        !(delay = pace_delay())) {
+      if(is_read) {
+        // Read buffer slot is tied to the iocb slot
+        cb = aio_engine_get(eng, fd, IOCB_CMD_PREAD, NULL, chunk_size,
+            base + j * chunk_size, j);
+        buf = rbuf + aio_engine_slot(eng, cb) * chunk_size;
+        cb->aio_buf = (uint64_t)buf;
+      } else {
+        cb = aio_engine_get(eng, fd, IOCB_CMD_PWRITE, piov[j].iov_base,
+            chunk_size, base + j * chunk_size, j);
+      }
+      if(aio_engine_submit(eng, cb)) {
+        return -1;
+      }
+      pace_charge(chunk_size);
+      j++;
+    }
+
+    // Reap at least one completion.  When waiting for the rate limit, reap
+    // whatever completes in the meantime so that latencies do not include
+    // the pacing.
+    if(delay && eng->inflight == 0) {
+      pace(0);
+    } else if(delay) {
+      timeout.tv_sec = delay / 1000000000L;
+      timeout.tv_nsec = delay % 1000000000L;
+      if(aio_engine_reap_timeout(eng, 1, &timeout, aio_pass_done, &ps) < 0) {
+        return -1;
+      }
+    } else if(aio_engine_reap(eng, 1, aio_pass_done, &ps) < 0) {
+      return -1;
+    }
+    delay = 0;
+    if(depth_ctl) {
+      depth_ctl_step(depth_ctl);
+    }
+  }
+
+  return 0;
+}
+
+// Open loop arrivals.  Chunk I/Os arrive at iops per second, either evenly
+// spaced or as a Poisson process, optionally only during the on part of an
+// on/off burst pattern.  Arrivals do not wait for earlier I/Os to complete,
+// so a stall delays the I/Os that arrive during it instead of suppressing
+// them (coordinated omission).  Response time is measured from the arrival
+// time, service time from when the I/O was actually issued.
+struct arrivals {
+  double iops;
+  int poisson;
+  double on;  // seconds, 0 for continuous arrivals
+  double off; // seconds
+  unsigned short xsubi[3];
+  int64_t start_ns; // Start of arrivals (and of the first on period)
+  int64_t next_ns;  // Arrival time of next I/O
+  uint64_t count;
+  struct lat_hist * response;
+};
+
+// Moves arr->next_ns to the next arrival
+static void arrival_next(struct arrivals * arr)
+{
+  double gap = 1 / arr->iops;
+  int64_t cycle;
+  int64_t phase;
+
+  if(arr->poisson) {
+    gap *= -log(1 - erand48(arr->xsubi));
+  }
+  arr->next_ns += gap * 1e9;
+
+  // Arrivals that fall in an off period move to the start of the next on
+  // period
+  if(arr->on > 0) {
+    cycle = (arr->on + arr->off) * 1e9;
+    phase = (arr->next_ns - arr->start_ns) % cycle;
+    if(phase >= arr->on * 1e9) {
+      arr->next_ns += cycle - phase;
+    }
+  }
+  arr->count++;
+}
+
+// State shared with open_pass_done
+struct open_pass_state {
+  struct aio_pass_state ps;
+  struct arrivals * arr;
+  int64_t * arrived; // Arrival time of the I/O in each slot
+};
+
+static int open_pass_done(struct iocb * cb, int64_t res, int64_t lat_ns,
+    void * arg)
+{
+  struct open_pass_state * ops = arg;
+  struct aio_engine * eng = ops->ps.eng;
+  int slot = aio_engine_slot(eng, cb);
+  struct timespec * sub = &eng->submitted[slot];
+
+  lat_hist_add(ops->arr->response, sub->tv_sec * 1000000000L + sub->tv_nsec
+      + lat_ns - ops->arrived[slot]);
+  return aio_pass_done(cb, res, lat_ns, &ops->ps);
+}
+
+// Reads or writes nchunks chunks of fd as they arrive according to arr.  With
+// an aio engine, up to eng->depth I/Os are in flight and arrivals wait only
+// when all are busy.  Without one (eng is NULL), I/Os are issued one at a
+// time and arrivals wait for the previous I/O.  Service times are added to
+// hist, response times to arr->response.  Buffers and verification are as for
+// aio_pass (or read_pass without an engine).  Returns 0 on success or -1 on
+// error.
+int open_pass(struct aio_engine * eng, int fd, int is_read,
+    struct iovec * piov, uint64_t nchunks, size_t chunk_size, char * rbuf,
+    int iter, struct lat_hist * hist, struct verify_state * v,
+    struct arrivals * arr)
+{
+  uint64_t j = 0;
+  int64_t now;
+  int64_t delay;
+  ssize_t rc;
+  struct iocb * cb;
+  struct timespec start, stop, timeout;
+  int64_t arrived[eng ? eng->depth : 1];
+  struct open_pass_state ops = {
+    .ps = {
+      .eng = eng,
+      .chunk_size = chunk_size,
+      .is_read = is_read,
+      .iter = iter,
+      .hist = hist,
+      .verify = v
+    },
+    .arr = arr,
+    .arrived = arrived
+  };
+
+  // Arrivals do not accumulate between passes
+  now = mono_ns();
+  if(!arr->start_ns) {
+    arr->start_ns = arr->next_ns = now;
+  } else if(arr->next_ns < now) {
+    arr->next_ns = now;
+  }
+
+  while(j < nchunks || (eng && eng->inflight > 0)) {
+    now = mono_ns();
+    if(!eng) {
+      // Wait for the next arrival, then issue it
+      if(arr->next_ns > now) {
+        sleep_until(arr->next_ns);
+      }
+      *arrived = arr->next_ns;
+      arrival_next(arr);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      wd_begin(0, &start);
+      if(is_read) {
+        rc = pread(fd, rbuf, chunk_size, j * chunk_size);
+      } else {
+        rc = pwrite(fd, piov[j].iov_base, chunk_size, j * chunk_size);
+      }
+      wd_end(0);
+      clock_gettime(CLOCK_MONOTONIC, &stop);
+      if(rc != chunk_size) {
+        if(rc == -1) {
+          perror(is_read ? "pread" : "pwrite");
+        } else {
+          printf("error: short %s of %ld bytes\n",
+              is_read ? "read" : "write", rc);
+        }
+        fprintf(stderr, "iter %d chunk %lu\n", iter, j);
+        return -1;
+      }
+      lat_hist_add(hist, ELAPSED_NS(start, stop));
+      lat_hist_add(arr->response,
+          stop.tv_sec * 1000000000L + stop.tv_nsec - *arrived);
+      if(v) {
+        verify_chunk(v, rbuf, j, iter);
+      }
+      j++;
+      continue;
+    }
+
+    // Issue every I/O that has arrived, as far as the queue allows
+    while(j < nchunks && eng->nfree > 0 && arr->next_ns <= now) {
+      if(is_read) {
+        cb = aio_engine_get(eng, fd, IOCB_CMD_PREAD, NULL, chunk_size,
+            j * chunk_size, j);
+        cb->aio_buf = (uint64_t)(rbuf +
+            aio_engine_slot(eng, cb) * chunk_size);
+      } else {
+        cb = aio_engine_get(eng, fd, IOCB_CMD_PWRITE, piov[j].iov_base,
+            chunk_size, j * chunk_size, j);
+      }
+      arrived[aio_engine_slot(eng, cb)] = arr->next_ns;
+      arrival_next(arr);
+      if(aio_engine_submit(eng, cb)) {
+        return -1;
+      }
+      j++;
+    }
+
+    // Reap completions until the next arrival, or at least one if the queue
+    // is full
+    if(j < nchunks && eng->nfree > 0) {
+      delay = arr->next_ns - mono_ns();
+      if(delay <= 0) {
+        continue;
+      } else if(eng->inflight == 0) {
+        sleep_until(arr->next_ns);
+        continue;
+      }
+      timeout.tv_sec = delay / 1000000000L;
+      timeout.tv_nsec = delay % 1000000000L;
+      if(aio_engine_reap_timeout(eng, 1, &timeout, open_pass_done, &ops) < 0) {
+        return -1;
+      }
+    } else if(aio_engine_reap(eng, 1, open_pass_done, &ops) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Cleared when the I/O mode is requested explicitly, so that O_DIRECT is never
+// silently dropped.
+static int direct_fallback = 1;
+
+// Opens filename with *oflags.  If O_DIRECT is not supported on the first
+// iteration, it is removed from *oflags and the open is retried.  Returns the
+// file descriptor or -1 on error after displaying diagnostics.
+int open_target(const char * filename, int * oflags, int iter)
+{
+  int fd;
+
+  fd = open(filename, *oflags, 0666);
+  if(fd == -1) {
+    // Maybe O_DIRECT is not supported?
+    if(errno == EINVAL && iter == 0 && (*oflags & O_DIRECT) &&
+        direct_fallback) {
+      *oflags &= ~O_DIRECT;
+      // Open file
+      fd = open(filename, *oflags, 0666);
+      if(fd == -1) {
+        perror(filename);
+      } else {
+        printf("warning: O_DIRECT not supported for %s\n", filename);
+      }
+    } else {
+      perror(filename);
+    }
+  }
+
+  return fd;
+}
+
+// Writes back any dirty pages of filename and drops its pages from the page
+// cache so that the next access goes to the device.  Returns 0 on success or
+// -1 on error.  A filename that does not exist yet has nothing to drop.
+int drop_cache(const char * filename)
+{
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if(fd == -1) {
+    if(errno == ENOENT) {
+      return 0;
+    }
+    perror(filename);
+    return -1;
+  }
+  if(fdatasync(fd) == -1) {
+    perror("fdatasync");
+    close(fd);
+    return -1;
+  }
+  if((errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))) {
+    perror("posix_fadvise");
+    close(fd);
+    return -1;
+  }
+
+  return close(fd);
+}
+
+// Run state saved by --state and restored by --resume.  The chunk rotation
+// and the PRNG streams are saved so that a resumed run continues with exactly
+// the data (and random offsets) that the original run would have used.
+struct dh_state {
+  unsigned int seed;
+  char mode[16];
+  size_t chunk_size;
+  uint32_t chunk_count;
+  size_t file_size;
+  int iters;
+  int completed;
+  uint64_t bytes;
+  uint32_t rotation;
+  unsigned short mix_xsubi[3];
+  unsigned short rmw_xsubi[3];
+  unsigned short discard_xsubi[3];
+};
+
+// Atomically replaces the state file at path with st by writing a temporary
+// file, syncing it and renaming it over path.  Returns 0 on success or -1 on
+// error.
+int state_save(const char * path, const struct dh_state * st)
+{
+  char tmp[PATH_MAX];
+  char dir[PATH_MAX];
+  char * slash;
+  FILE * f;
+  int fd;
+  int rc;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "w");
+  if(!f) {
+    perror(tmp);
+    return -1;
+  }
+  fprintf(f, "# disk_hammer state\n");
+  fprintf(f, "seed %u\n", st->seed);
+  fprintf(f, "mode %s\n", st->mode);
+  fprintf(f, "chunk_size %lu\n", st->chunk_size);
+  fprintf(f, "chunk_count %u\n", st->chunk_count);
+  fprintf(f, "file_size %lu\n", st->file_size);
+  fprintf(f, "iters %d\n", st->iters);
+  fprintf(f, "completed %d\n", st->completed);
+  fprintf(f, "bytes %lu\n", st->bytes);
+  fprintf(f, "rotation %u\n", st->rotation);
+  fprintf(f, "mix_xsubi %hu %hu %hu\n", st->mix_xsubi[0],
+      st->mix_xsubi[1], st->mix_xsubi[2]);
+  fprintf(f, "rmw_xsubi %hu %hu %hu\n", st->rmw_xsubi[0],
+      st->rmw_xsubi[1], st->rmw_xsubi[2]);
+  fprintf(f, "discard_xsubi %hu %hu %hu\n", st->discard_xsubi[0],
+      st->discard_xsubi[1], st->discard_xsubi[2]);
+  rc = fflush(f) || fsync(fileno(f));
+  if(fclose(f) || rc) {
+    perror(tmp);
+    return -1;
+  }
+  if(rename(tmp, path) == -1) {
+    perror("rename");
+    return -1;
+  }
+
+  // Sync the directory so that the rename itself is durable
+  snprintf(dir, sizeof(dir), "%s", path);
+  slash = strrchr(dir, '/');
+  if(slash) {
+    slash[slash == dir] = '\0';
+  } else {
+    strcpy(dir, ".");
+  }
+  fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if(fd == -1) {
+    perror(dir);
+    return -1;
+  }
+  if(fsync(fd) == -1) {
+    perror(dir);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  return 0;
+}
+
+// Loads the state file at path into st.  Returns 0 on success or -1 on error
+// after displaying diagnostics.
+int state_load(const char * path, struct dh_state * st)
+{
+  FILE * f;
+  char line[256];
+  char key[32];
+  const char * v;
+  int n = 0;
+
+  f = fopen(path, "r");
+  if(!f) {
+    perror(path);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    if(line[0] == '#' || sscanf(line, "%31s", key) != 1) {
+      continue;
+    }
+    v = line + strlen(key);
+    if(!strcmp(key, "seed")) {
+      n += sscanf(v, "%u", &st->seed);
+    } else if(!strcmp(key, "mode")) {
+      n += sscanf(v, "%15s", st->mode);
+    } else if(!strcmp(key, "chunk_size")) {
+      n += sscanf(v, "%lu", &st->chunk_size);
+    } else if(!strcmp(key, "chunk_count")) {
+      n += sscanf(v, "%u", &st->chunk_count);
+    } else if(!strcmp(key, "file_size")) {
+      n += sscanf(v, "%lu", &st->file_size);
+    } else if(!strcmp(key, "iters")) {
+      n += sscanf(v, "%d", &st->iters);
+    } else if(!strcmp(key, "completed")) {
+      n += sscanf(v, "%d", &st->completed);
+    } else if(!strcmp(key, "bytes")) {
+      n += sscanf(v, "%lu", &st->bytes);
+    } else if(!strcmp(key, "rotation")) {
+      n += sscanf(v, "%u", &st->rotation);
+    } else if(!strcmp(key, "mix_xsubi")) {
+      n += sscanf(v, "%hu %hu %hu", &st->mix_xsubi[0], &st->mix_xsubi[1],
+          &st->mix_xsubi[2]) == 3;
+    } else if(!strcmp(key, "rmw_xsubi")) {
+      n += sscanf(v, "%hu %hu %hu", &st->rmw_xsubi[0], &st->rmw_xsubi[1],
+          &st->rmw_xsubi[2]) == 3;
+    } else if(!strcmp(key, "discard_xsubi")) {
+      n += sscanf(v, "%hu %hu %hu", &st->discard_xsubi[0],
+          &st->discard_xsubi[1], &st->discard_xsubi[2]) == 3;
+    }
+  }
+  fclose(f);
+
+  if(n != 12) {
+    printf("error: incomplete state file %s\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+// One point of the throughput versus fullness curve of fill mode
+struct fill_sample {
+  double pct;
+  double gbps;
+};
+
+// Fill mode state.  For directories, each segment is a file named
+// fill%08lu in the directory.  For block devices, segment k is the k'th
+// LENGTH byte region of the device.
+struct fill_state {
+  const char * target;
+  int is_blk;
+  size_t dev_size;
+  size_t seg_size;
+  uint64_t seg_chunks;
+  size_t chunk_size;
+  uint32_t chunk_count;
+  struct iovec * iovs;
+  int oflags;
+  double target_pct;
+  // Live segments (files or device regions)
+  uint64_t * segs;
+  uint64_t nsegs;
+  uint64_t maxsegs;
+  uint64_t next_seg;  // Next new file number or device segment
+  // Curve samples
+  struct fill_sample * samples;
+  uint64_t nsamples;
+  uint64_t maxsamples;
+  int enospc;
+};
+
+// Returns how full the fill target is, in percent
+double fill_pct(struct fill_state * fs)
+{
+  struct statvfs sv;
+  uint64_t used;
+
+  if(fs->is_blk) {
+    return 100.0 * fs->nsegs * fs->seg_size / fs->dev_size;
+  }
+  if(statvfs(fs->target, &sv) == -1) {
+    perror("statvfs");
+    return -1;
+  }
+  // Same calculation as df
+  used = sv.f_blocks - sv.f_bfree;
+  return 100.0 * used / (used + sv.f_bavail);
+}
+
+// Appends v to the dynamic array *a of *n elements with room for *max
+static int fill_append(void ** a, uint64_t * n, uint64_t * max, size_t size,
+    const void * v)
+{
+  void * p;
+
+  if(*n == *max) {
+    *max = *max ? 2 * *max : 1024;
+    if(!(p = realloc(*a, *max * size))) {
+      perror("realloc[fill]");
+      return -1;
+    }
+    *a = p;
+  }
+  memcpy((char *)*a + *n * size, v, size);
+  (*n)++;
+  return 0;
+}
+
+// Writes segment seg of the fill target, then records the throughput and
+// resulting fullness.  Running out of space sets fs->enospc and is not an
+// error.  Returns 0 on success or -1 on error.
+int fill_segment(struct fill_state * fs, uint64_t seg, const char * label)
+{
+  int fd;
+  int rc;
+  char path[PATH_MAX];
+  const char * name = fs->target;
+  struct timespec start, stop;
+  struct fill_sample sample;
+  int64_t elapsed_ns;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
+
+  if(!fs->is_blk) {
+    snprintf(path, sizeof(path), "%s/fill%08lu", fs->target, seg);
+    name = path;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  fd = open_target(name, &fs->oflags, fs->nsamples);
+  if(fd == -1) {
+    return -1;
+  }
+  if(fs->is_blk && lseek(fd, seg * fs->seg_size, SEEK_SET) == -1) {
+    perror("lseek");
+    close(fd);
+    return -1;
+  }
+  rc = write_pass(fd, &fs->iovs[seg % fs->chunk_count], fs->seg_chunks,
+      fs->chunk_size, seg, NULL, NULL);
+  if(rc && errno == ENOSPC) {
+    fs->enospc = 1;
+  }
+  if(close(fd) == -1 && !fs->enospc) {
+    perror("close");
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  if(fs->enospc) {
+    printf("reached ENOSPC writing %s\n", name);
+    return 0;
+  } else if(rc) {
+    return -1;
+  }
+
+  if(fill_append((void **)&fs->segs, &fs->nsegs, &fs->maxsegs,
+        sizeof(*fs->segs), &seg)) {
+    return -1;
+  }
+
+  elapsed_ns = ELAPSED_NS(start, stop);
+  sample.pct = fill_pct(fs);
+  sample.gbps = (8.0 * fs->seg_size) / elapsed_ns;
+  if(fill_append((void **)&fs->samples, &fs->nsamples, &fs->maxsamples,
+        sizeof(*fs->samples), &sample)) {
+    return -1;
+  }
+
+  time(&now);
+  strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+  printf("%s %s %lu bytes in %lu ns (%.3f Gbps) %.1f%% full\n", strnow,
+      label, fs->seg_size, elapsed_ns, sample.gbps, sample.pct);
+  fflush(stdout);
+
+  return 0;
+}
+
+// Writes new segments until the target fullness is reached, space runs out
+// or the end of the device is reached.  Returns 0 on success or -1 on error.
+int fill_to_target(struct fill_state * fs, const char * label)
+{
+  fs->enospc = 0;
+  while(run && !fs->enospc && fill_pct(fs) < fs->target_pct) {
+    if(fs->is_blk && (fs->next_seg + 1) * fs->seg_size > fs->dev_size) {
+      printf("reached end of %s\n", fs->target);
+      break;
+    }
+    if(fill_segment(fs, fs->next_seg++, label)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Deletes a random fraction of the live segments, storing their numbers in
+// deleted.  Files are unlinked and device segments are discarded.  Returns
+// the number of segments deleted or -1 on error.
+int64_t fill_age(struct fill_state * fs, double fraction,
+    unsigned short xsubi[3], uint64_t * deleted)
+{
+  int fd = -1;
+  uint64_t i;
+  uint64_t j;
+  uint64_t n;
+  uint64_t tmp;
+  char path[PATH_MAX];
+
+  n = fraction * fs->nsegs + 0.5;
+  if(fs->is_blk && (fd = open(fs->target, O_WRONLY)) == -1) {
+    perror(fs->target);
+    return -1;
+  }
+
+  // Partial Fisher-Yates shuffle moves n random segments to the end
+  for(i=0; i<n; i++) {
+    j = nrand48(xsubi) % (fs->nsegs - i);
+    tmp = fs->segs[j];
+    fs->segs[j] = fs->segs[fs->nsegs-1-i];
+    fs->segs[fs->nsegs-1-i] = tmp;
+    deleted[i] = tmp;
+
+    if(fs->is_blk) {
+      if(discard_range(fd, 1, tmp * fs->seg_size, fs->seg_size, NULL)) {
+        return -1;
+      }
+    } else {
+      snprintf(path, sizeof(path), "%s/fill%08lu", fs->target, tmp);
+      if(unlink(path) == -1) {
+        perror(path);
+        return -1;
+      }
+    }
+  }
+  fs->nsegs -= n;
+
+  if(fd != -1) {
+    close(fd);
+  }
+  if(!fs->is_blk) {
+    sync();
+  }
+
+  return n;
+}
+
+// Prints the throughput versus fullness curve of samples[first..nsamples),
+// averaged over bins of 5 percent.
+void fill_print_curve(const struct fill_state * fs, uint64_t first,
+    const char * label)
+{
+  int b;
+  uint64_t i;
+  uint64_t n[21] = {0};
+  double sum[21] = {0};
+
+  for(i=first; i<fs->nsamples; i++) {
+    b = fs->samples[i].pct / 5;
+    if(b < 0) {
+      b = 0;
+    } else if(b > 20) {
+      b = 20;
+    }
+    sum[b] += fs->samples[i].gbps;
+    n[b]++;
+  }
+
+  printf("%s curve: percent full vs Gbps\n", label);
+  for(b=0; b<=20; b++) {
+    if(n[b]) {
+      printf("  %3d-%3d%% %8.3f Gbps (%lu samples)\n",
+          5*b, b < 20 ? 5*b+5 : 100, sum[b] / n[b], n[b]);
+    }
+  }
+}
+
+// Runs fill mode: fill target (a directory or block device) with seg_size
+// byte segments until it is target_pct percent full, then optionally perform
+// nrounds rounds (0 for rounds until interrupted) of deleting a random age
+// fraction of the segments and refilling.  Returns 0 on success or -1 on
+// error.
+int fill_run(const char * target, size_t seg_size, uint64_t seg_chunks,
+    size_t chunk_size, uint32_t chunk_count, struct iovec * iovs,
+    double target_pct, double age, int nrounds)
+{
+  int fd;
+  int r;
+  int64_t ndeleted;
+  uint64_t i;
+  uint64_t first;
+  uint64_t * deleted = NULL;
+  struct stat st;
+  unsigned short xsubi[3] = {0x5eed, SEED & 0xffff, (SEED >> 16) & 0xffff};
+  struct fill_state fs = {
+    .target = target,
+    .seg_size = seg_size,
+    .seg_chunks = seg_chunks,
+    .chunk_size = chunk_size,
+    .chunk_count = chunk_count,
+    .iovs = iovs,
+    .oflags = O_WRONLY | O_CREAT | O_DIRECT,
+    .target_pct = target_pct
+  };
+
+  if(stat(target, &st) == -1) {
+    perror(target);
+    return -1;
+  }
+  fs.is_blk = S_ISBLK(st.st_mode);
+  if(fs.is_blk) {
+    if((fd = open(target, O_RDONLY)) == -1) {
+      perror(target);
+      return -1;
+    }
+    if(ioctl(fd, BLKGETSIZE64, &fs.dev_size) == -1) {
+      perror("ioctl[BLKGETSIZE64]");
+      return -1;
+    }
+    close(fd);
+    fs.oflags = O_WRONLY | O_DIRECT;
+  } else if(!S_ISDIR(st.st_mode)) {
+    printf("error: fill target %s is not a directory or block device\n",
+        target);
+    return -1;
+  }
+
+  if(fill_to_target(&fs, "wrote")) {
+    return -1;
+  }
+  fill_print_curve(&fs, 0, "fill");
+
+  for(r=0; run && age > 0 && (r < nrounds || nrounds == 0); r++) {
+    if(!(deleted = realloc(deleted, fs.nsegs * sizeof(*deleted)))) {
+      perror("realloc[deleted]");
+      return -1;
+    }
+    if((ndeleted = fill_age(&fs, age, xsubi, deleted)) < 0) {
+      return -1;
+    }
+    printf("aging round %d deleted %ld segments, %.1f%% full\n",
+        r, ndeleted, fill_pct(&fs));
+
+    first = fs.nsamples;
+    if(fs.is_blk) {
+      // Rewrite the discarded regions of the device
+      fs.enospc = 0;
+      for(i=0; run && i<ndeleted && !fs.enospc; i++) {
+        if(fill_segment(&fs, deleted[i], "refilled")) {
+          return -1;
+        }
+      }
+    } else if(fill_to_target(&fs, "refilled")) {
+      return -1;
+    }
+    fill_print_curve(&fs, first, "refill");
+  }
+
+  free(deleted);
+  free(fs.segs);
+  free(fs.samples);
+
+  return 0;
+}
+
+// Number of zone descriptors requested per BLKREPORTZONE call
+#define ZONE_REPORT_BATCH 1024
+
+// Fills zones with the descriptors of all nr_zones zones of zoned block
+// device fd.  Kernels that do not report zone capacity get it set to the
+// zone length.  Returns 0 on success or -1 on error.
+int zone_report(int fd, struct blk_zone * zones, uint32_t nr_zones)
+{
+  uint32_t i;
+  uint32_t got = 0;
+  uint64_t sector = 0;
+  struct blk_zone_report * rep;
+
+  rep = malloc(sizeof(*rep) + ZONE_REPORT_BATCH * sizeof(struct blk_zone));
+  if(!rep) {
+    perror("malloc[blk_zone_report]");
+    return -1;
+  }
+
+  while(got < nr_zones) {
+    memset(rep, 0, sizeof(*rep));
+    rep->sector = sector;
+    rep->nr_zones = ZONE_REPORT_BATCH;
+    if(ioctl(fd, BLKREPORTZONE, rep) == -1) {
+      perror("ioctl[BLKREPORTZONE]");
+      free(rep);
+      return -1;
+    }
+    if(rep->nr_zones == 0) {
+      break;
+    }
+    if(rep->nr_zones > nr_zones - got) {
+      rep->nr_zones = nr_zones - got;
+    }
+    memcpy(&zones[got], rep->zones, rep->nr_zones * sizeof(*zones));
+    if(!(rep->flags & BLK_ZONE_REP_CAPACITY)) {
+      for(i=got; i<got+rep->nr_zones; i++) {
+        zones[i].capacity = zones[i].len;
+      }
+    }
+    got += rep->nr_zones;
+    sector = zones[got-1].start + zones[got-1].len;
+  }
+
+  free(rep);
+  return 0;
+}
+
+// Resets the write pointer of zone z of fd, adding the time taken to hist.
+// Returns 0 on success or -1 on error.
+int zone_reset(int fd, const struct blk_zone * z, struct lat_hist * hist)
+{
+  struct blk_zone_range range = {
+    .sector = z->start,
+    .nr_sectors = z->len
+  };
+  struct timespec start, stop;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(ioctl(fd, BLKRESETZONE, &range) == -1) {
+    perror("ioctl[BLKRESETZONE]");
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  lat_hist_add(hist, ELAPSED_NS(start, stop));
+
+  return 0;
+}
+
+// Runs the zoned workload on zoned block device filename for niters passes.
+// Each pass writes up to budget bytes, filling the sequential write zones in
+// order, each starting from its current write pointer and ending at its
+// capacity.  The zones written by a pass are reset before the next pass.
+// When eng is non-NULL, zone writes are issued through the aio engine, which
+// must have a depth of 1.  Returns 0 on success or -1 on error.
+int zoned_run(const char * filename, size_t budget, size_t chunk_size,
+    uint32_t chunk_count, struct iovec * iovs, struct aio_engine * eng,
+    int niters)
+{
+  int fd;
+  int i;
+  uint32_t z;
+  uint32_t nr_zones;
+  uint32_t nwritten = 0;
+  uint32_t * written;
+  uint64_t wp;
+  uint64_t end;
+  uint64_t nchunks;
+  size_t remaining;
+  size_t pass_bytes;
+  struct blk_zone * zones;
+  struct lat_hist * whist;
+  struct lat_hist * rhist;
+  struct timespec start, stop, zstart, zstop;
+  int64_t elapsed_ns;
+  double gbps;
+  double zmin = 0, zmax = 0, zsum = 0;
+  uint64_t nz = 0;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
+
+  fd = open(filename, O_WRONLY | O_DIRECT);
+  if(fd == -1) {
+    perror(filename);
+    return -1;
+  }
+
+  if(ioctl(fd, BLKGETNRZONES, &nr_zones) == -1) {
+    perror("ioctl[BLKGETNRZONES]");
+    return -1;
+  } else if(nr_zones == 0) {
+    printf("error: %s is not a zoned block device\n", filename);
+    return -1;
+  }
+  printf("%s has %u zones\n", filename, nr_zones);
+
+  zones = calloc(nr_zones, sizeof(*zones));
+  written = calloc(nr_zones, sizeof(*written));
+  whist = calloc(1, sizeof(*whist));
+  rhist = calloc(1, sizeof(*rhist));
+  if(!zones || !written || !whist || !rhist) {
+    perror("calloc[zones]");
+    return -1;
+  }
+
+  for(i=0; run && (i < niters || niters == 0); i++) {
+    // Reset the zones written by the previous pass
+    for(z=0; z<nwritten && i>0; z++) {
+      if(zone_reset(fd, &zones[written[z]], rhist)) {
+        return -1;
+      }
+    }
+
+    if(zone_report(fd, zones, nr_zones)) {
+      return -1;
+    }
+
+    nwritten = 0;
+    pass_bytes = 0;
+    remaining = budget;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(z=0; run && z<nr_zones && remaining >= chunk_size; z++) {
+      if(zones[z].type == BLK_ZONE_TYPE_CONVENTIONAL ||
+          zones[z].cond == BLK_ZONE_COND_FULL ||
+          zones[z].cond == BLK_ZONE_COND_READONLY ||
+          zones[z].cond == BLK_ZONE_COND_OFFLINE) {
+        continue;
+      }
+
+      // Write from write pointer to the end of the zone's capacity
+      wp = zones[z].wp << 9;
+      end = (zones[z].start + zones[z].capacity) << 9;
+      nchunks = (end - wp) / chunk_size;
+      if(nchunks > remaining / chunk_size) {
+        nchunks = remaining / chunk_size;
+      }
+      if(nchunks == 0) {
+        continue;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &zstart);
+      if(eng) {
+        if(aio_pass(eng, fd, 0, wp, &iovs[(i + z) % chunk_count], nchunks,
+              chunk_size, NULL, i, whist, NULL)) {
+          return -1;
+        }
+      } else {
+        if(lseek(fd, wp, SEEK_SET) == -1) {
+          perror("lseek");
+          return -1;
+        }
+        if(write_pass(fd, &iovs[(i + z) % chunk_count], nchunks, chunk_size,
+              i, whist, NULL)) {
+          return -1;
+        }
+      }
+      clock_gettime(CLOCK_MONOTONIC, &zstop);
+
+      written[nwritten++] = z;
+      pass_bytes += nchunks * chunk_size;
+      remaining -= nchunks * chunk_size;
+
+      elapsed_ns = ELAPSED_NS(zstart, zstop);
+      gbps = (8.0 * nchunks * chunk_size) / elapsed_ns;
+      if(nz == 0 || gbps < zmin) {
+        zmin = gbps;
+      }
+      if(gbps > zmax) {
+        zmax = gbps;
+      }
+      zsum += gbps;
+      nz++;
+      printf("zone %u at %lu wrote %lu bytes in %lu ns (%.3f Gbps)\n",
+          z, wp, nchunks * chunk_size, elapsed_ns, gbps);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    elapsed_ns = ELAPSED_NS(start, stop);
+
+    time(&now);
+    strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+    printf("%s wrote %lu bytes to %u zones in %lu ns (%.3f Gbps)\n", strnow,
+        pass_bytes, nwritten, elapsed_ns,
+        elapsed_ns ? (8.0 * pass_bytes)/elapsed_ns : 0.0);
+    fflush(stdout);
+
+    if(nwritten == 0) {
+      printf("error: no writable zones\n");
+      return -1;
+    }
+  }
+
+  if(nz) {
+    printf("zone throughput Gbps: zones %lu min %.3f avg %.3f max %.3f\n",
+        nz, zmin, zsum / nz, zmax);
+  }
+  lat_hist_print(eng ? "chunk write" : "write", whist);
+  lat_hist_print("zone reset", rhist);
+
+  close(fd);
+  free(zones);
+  free(written);
+  free(whist);
+  free(rhist);
+
+  return 0;
+}
+
+// I/O trace record.  Timestamps are relative to the start of the trace.  The
+// original latency is 0 if the trace does not include it.
+struct trace_rec {
+  uint64_t ts_ns;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t lat_ns;
+  int is_read;
+};
+
+// Binary traces start with this magic followed by packed little endian
+// records of struct trace_bin_rec.
+#define TRACE_MAGIC "DHTRACE1"
+
+struct trace_bin_rec {
+  uint64_t ts_ns;
+  uint64_t offset;
+  uint64_t lat_ns;
+  uint32_t length;
+  uint8_t op; // 'R' or 'W'
+  uint8_t pad[3];
+} __attribute__((packed));
+
+// Orders trace records by timestamp
+static int trace_rec_cmp(const void * a, const void * b)
+{
+  const struct trace_rec * ra = a;
+  const struct trace_rec * rb = b;
+
+  return ra->ts_ns < rb->ts_ns ? -1 : ra->ts_ns > rb->ts_ns;
+}
+
+// Loads trace path into a newly allocated array *recs of *nrecs records,
+// sorted by timestamp.  Text traces have one record per line:
+//
+//   TIMESTAMP OP OFFSET LENGTH [LATENCY]
+//
+// where TIMESTAMP and LATENCY are in seconds, OP is R or W, and OFFSET and
+// LENGTH are in bytes.  Blank lines and lines starting with '#' are ignored.
+// Returns 0 on success or -1 on error.
+int trace_load(const char * path, struct trace_rec ** recs, uint64_t * nrecs)
+{
+  FILE * f;
+  char line[256];
+  char op[16];
+  char magic[sizeof(TRACE_MAGIC)-1];
+  double ts;
+  double lat;
+  int n;
+  uint64_t k;
+  uint64_t lineno = 0;
+  uint64_t max = 0;
+  struct trace_rec rec;
+  struct trace_bin_rec brec;
+  int binary;
+
+  f = fopen(path, "r");
+  if(!f) {
+    perror(path);
+    return -1;
+  }
+  binary = fread(magic, sizeof(magic), 1, f) == 1 &&
+    !memcmp(magic, TRACE_MAGIC, sizeof(magic));
+  if(!binary) {
+    rewind(f);
+  }
+
+  *recs = NULL;
+  *nrecs = 0;
+  for(;;) {
+    if(binary) {
+      if(fread(&brec, sizeof(brec), 1, f) != 1) {
+        break;
+      }
+      rec.ts_ns = brec.ts_ns;
+      rec.offset = brec.offset;
+      rec.length = brec.length;
+      rec.lat_ns = brec.lat_ns;
+      rec.is_read = (brec.op == 'R' || brec.op == 'r');
+    } else {
+      if(!fgets(line, sizeof(line), f)) {
+        break;
+      }
+      lineno++;
+      lat = 0;
+      n = sscanf(line, "%lf %15s %lu %lu %lf",
+          &ts, op, &rec.offset, &rec.length, &lat);
+      if(n <= 0 || line[strspn(line, " \t")] == '#') {
+        continue;
+      } else if(n < 4 || !strchr("RrWw", op[0])) {
+        printf("error: %s line %lu: expected TIMESTAMP OP OFFSET LENGTH"
+            " [LATENCY]\n", path, lineno);
+        fclose(f);
+        return -1;
+      }
+      rec.ts_ns = ts * 1e9;
+      rec.lat_ns = lat * 1e9;
+      rec.is_read = (op[0] == 'R' || op[0] == 'r');
+    }
+    if(rec.length == 0) {
+      continue;
+    }
+    if(fill_append((void **)recs, nrecs, &max, sizeof(rec), &rec)) {
+      fclose(f);
+      return -1;
+    }
+  }
+
+  fclose(f);
+  if(*nrecs == 0) {
+    printf("error: %s contains no I/O records\n", path);
+    return -1;
+  }
+
+  // Records that go back in time (e.g. merged from per-CPU buffers) are
+  // sorted, so the first record has the earliest timestamp and the last the
+  // latest
+  for(k=1; k<*nrecs && (*recs)[k].ts_ns >= (*recs)[k-1].ts_ns; k++) {
+  }
+  if(k < *nrecs) {
+    printf("warning: %s records are not in time order, sorting them\n",
+        path);
+    qsort(*recs, *nrecs, sizeof(**recs), trace_rec_cmp);
+  }
+  return 0;
+}
+
+// State for replaying a trace
+struct replay_state {
+  const struct trace_rec * recs;
+  uint64_t nrecs;
+  int fd;
+  const char * buffer;
+  int alignment;
+  size_t chunk_size;
+  uint32_t chunk_count;
+  size_t max_len;
+  uint64_t max_iovs;
+  char * rbufs;          // max_len bytes per I/O slot
+  struct iovec * slot_iovs; // max_iovs iovecs per I/O slot
+  struct lat_hist * rhist;
+  struct lat_hist * whist;
+  struct lat_hist * lag;
+  uint64_t bytes;
+  int iter;
+};
+
+// Prepares the iovecs of slot for record k.  Writes are gathered from the
+// unique chunks of the buffer (rotating with k), reads land in the slot's
+// read buffer.  Returns the number of iovecs.
+static int replay_iovs(struct replay_state * rs, int slot, uint64_t k)
+{
+  const struct trace_rec * rec = &rs->recs[k];
+  struct iovec * iov = &rs->slot_iovs[slot * rs->max_iovs];
+  uint64_t left = rec->length;
+  int n = 0;
+
+  if(rec->is_read) {
+    iov[0].iov_base = rs->rbufs + slot * rs->max_len;
+    iov[0].iov_len = rec->length;
+    return 1;
+  }
+  while(left > 0) {
+    iov[n].iov_base = (char *)rs->buffer +
+      ((k + n) % rs->chunk_count) * rs->alignment;
+    iov[n].iov_len = left < rs->chunk_size ? left : rs->chunk_size;
+    left -= iov[n].iov_len;
+    n++;
+  }
+  return n;
+}
+
+static int replay_done(struct iocb * cb, int64_t res, int64_t lat_ns,
+    void * arg)
+{
+  struct replay_state * rs = arg;
+  const struct trace_rec * rec = &rs->recs[cb->aio_data];
+
+  if(res != rec->length) {
+    if(res < 0) {
+      fprintf(stderr, "aio %s: %s\n", rec->is_read ? "read" : "write",
+          strerror(-res));
+    } else {
+      printf("error: short %s of %ld bytes\n",
+          rec->is_read ? "read" : "write", res);
+    }
+    fprintf(stderr, "iter %d record %llu offset %lu length %lu\n",
+        rs->iter, cb->aio_data, rec->offset, rec->length);
+    return -1;
+  }
+  lat_hist_add(rec->is_read ? rs->rhist : rs->whist, lat_ns);
+  rs->bytes += rec->length;
+  return 0;
+}
+
+// Adds ns nanoseconds to *ts
+static void timespec_add_ns(struct timespec * ts, int64_t ns)
+{
+  ts->tv_sec += ns / 1000000000;
+  ts->tv_nsec += ns % 1000000000;
+  if(ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+// Replays all records of rs once.  Each record is issued at its original
+// timestamp (relative to the earliest, rs->recs[0]) divided by speed (or as
+// soon as possible if speed is 0) from the start of the pass.  With eng, up
+// to eng->depth records are in flight, preserving the concurrency of the
+// original workload.  Without eng, records are issued one at a time.  When
+// replaying with original timing, the lateness of each issue relative to its
+// scheduled time is added to rs->lag.  Returns 0 on success or -1 on error.
+int replay_pass(struct replay_state * rs, struct aio_engine * eng,
+    double speed)
+{
+  uint64_t k = 0;
+  int slot;
+  int niovs;
+  int64_t wait_ns;
+  ssize_t rc;
+  struct iocb * cb;
+  struct timespec t0, due, now, start, stop, timeout;
+  const struct trace_rec * rec;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  while(k < rs->nrecs || (eng && eng->inflight > 0)) {
+    if(k < rs->nrecs) {
+      rec = &rs->recs[k];
+      due = t0;
+      if(speed > 0) {
+        timespec_add_ns(&due, (rec->ts_ns - rs->recs[0].ts_ns) / speed);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      wait_ns = ELAPSED_NS(now, due);
+    } else {
+      wait_ns = INT64_MAX;
+    }
+
+    if(eng) {
+      if(wait_ns <= 0 && eng->nfree > 0) {
+        // Issue next record
+        cb = aio_engine_get(eng, rs->fd, 0, NULL, 0, rec->offset, k);
+        slot = aio_engine_slot(eng, cb);
+        niovs = replay_iovs(rs, slot, k);
+        cb->aio_lio_opcode = rec->is_read ? IOCB_CMD_PREADV : IOCB_CMD_PWRITEV;
+        cb->aio_buf = (uint64_t)&rs->slot_iovs[slot * rs->max_iovs];
+        cb->aio_nbytes = niovs;
+        if(speed > 0) {
+          lat_hist_add(rs->lag, -wait_ns);
+        }
+        if(aio_engine_submit(eng, cb)) {
+          return -1;
+        }
+        k++;
+      } else if(eng->inflight > 0) {
+        // Reap completions until the next record is due
+        if(k < rs->nrecs && wait_ns > 0 && eng->nfree > 0) {
+          timeout.tv_sec = wait_ns / 1000000000;
+          timeout.tv_nsec = wait_ns % 1000000000;
+          if(aio_engine_reap_timeout(eng, 1, &timeout, replay_done, rs) < 0) {
+            return -1;
+          }
+        } else if(aio_engine_reap(eng, 1, replay_done, rs) < 0) {
+          return -1;
+        }
+      } else {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+      }
+    } else {
+      if(wait_ns > 0) {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait_ns = ELAPSED_NS(now, due);
+      }
+      if(speed > 0) {
+        lat_hist_add(rs->lag, wait_ns < 0 ? -wait_ns : 0);
+      }
+      niovs = replay_iovs(rs, 0, k);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if(rec->is_read) {
+        rc = preadv(rs->fd, rs->slot_iovs, niovs, rec->offset);
+      } else {
+        rc = pwritev(rs->fd, rs->slot_iovs, niovs, rec->offset);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &stop);
+      if(rc != rec->length) {
+        if(rc == -1) {
+          perror(rec->is_read ? "preadv[replay]" : "pwritev[replay]");
+        } else {
+          printf("error: short %s of %ld bytes\n",
+              rec->is_read ? "read" : "write", rc);
+        }
+        fprintf(stderr, "iter %d record %lu offset %lu length %lu\n",
+            rs->iter, k, rec->offset, rec->length);
+        return -1;
+      }
+      lat_hist_add(rec->is_read ? rs->rhist : rs->whist,
+          ELAPSED_NS(start, stop));
+      rs->bytes += rec->length;
+      k++;
+    }
+  }
+
+  return 0;
+}
+
+// Prints replayed latency percentiles next to the original ones from the
+// trace for records of one direction.
+static void replay_compare(const char * label, const struct lat_hist * h,
+    const struct lat_hist * orig)
+{
+  static const double pcts[] = {50, 90, 99, 99.9};
+  int i;
+
+  lat_hist_print(label, h);
+  if(orig->count == 0 || h->count == 0) {
+    return;
+  }
+  printf("%s original latency ns: count %lu avg %.0f", label, orig->count,
+      orig->sum_ns / orig->count);
+  for(i=0; i<sizeof(pcts)/sizeof(pcts[0]); i++) {
+    printf(" p%g %lu", pcts[i], lat_hist_pct(orig, pcts[i]));
+  }
+  printf("\n%s replayed/original:", label);
+  for(i=0; i<sizeof(pcts)/sizeof(pcts[0]); i++) {
+    printf(" p%g %.2f", pcts[i],
+        (double)lat_hist_pct(h, pcts[i]) / lat_hist_pct(orig, pcts[i]));
+  }
+  printf("\n");
+}
+
+// Replays trace tracefile against filename niters times.  Returns 0 on
+// success or -1 on error.
+int replay_run(const char * tracefile, const char * filename,
+    const char * buffer, int alignment, size_t chunk_size,
+    uint32_t chunk_count, struct aio_engine * eng, double speed, int niters)
+{
+  int i;
+  int oflags = O_RDWR | O_CREAT | O_DIRECT;
+  int nslots = eng ? eng->depth : 1;
+  uint64_t k;
+  uint64_t nreads = 0;
+  uint64_t extent = 0;
+  struct stat st;
+  struct trace_rec * recs;
+  struct lat_hist * orig_r;
+  struct lat_hist * orig_w;
+  struct timespec start, stop;
+  int64_t elapsed_ns;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC") + 1];
+  struct replay_state rs = {
+    .buffer = buffer,
+    .alignment = alignment,
+    .chunk_size = chunk_size,
+    .chunk_count = chunk_count
+  };
+
+  if(trace_load(tracefile, &recs, &rs.nrecs)) {
+    return -1;
+  }
+  rs.recs = recs;
+
+  orig_r = calloc(1, sizeof(*orig_r));
+  orig_w = calloc(1, sizeof(*orig_w));
+  rs.rhist = calloc(1, sizeof(*rs.rhist));
+  rs.whist = calloc(1, sizeof(*rs.whist));
+  rs.lag = calloc(1, sizeof(*rs.lag));
+  if(!orig_r || !orig_w || !rs.rhist || !rs.whist || !rs.lag) {
+    perror("calloc[replay]");
+    return -1;
+  }
+
+  // Size the per-slot buffers and check whether O_DIRECT can be used
+  for(k=0; k<rs.nrecs; k++) {
+    if(recs[k].length > rs.max_len) {
+      rs.max_len = recs[k].length;
+    }
+    if((recs[k].offset | recs[k].length) & (alignment - 1)) {
+      oflags &= ~O_DIRECT;
+    }
+    if(recs[k].lat_ns) {
+      lat_hist_add(recs[k].is_read ? orig_r : orig_w, recs[k].lat_ns);
+    }
+    if(recs[k].is_read && recs[k].offset + recs[k].length > extent) {
+      extent = recs[k].offset + recs[k].length;
+    }
+    nreads += recs[k].is_read;
+  }
+  printf("replaying %lu records (%lu reads, %lu writes) from %s\n",
+      rs.nrecs, nreads, rs.nrecs - nreads, tracefile);
+  if(!(oflags & O_DIRECT)) {
+    printf("warning: trace has I/Os not aligned to %d bytes,"
+        " not using O_DIRECT\n", alignment);
+  }
+
+  rs.max_iovs = (rs.max_len + chunk_size - 1) / chunk_size;
+  rs.slot_iovs = calloc(nslots * rs.max_iovs, sizeof(*rs.slot_iovs));
+  if(!rs.slot_iovs) {
+    perror("calloc[replay iovs]");
+    return -1;
+  }
+  if((errno=posix_memalign((void **)&rs.rbufs, alignment,
+          nslots * rs.max_len))) {
+    perror("posix_memalign[replay]");
+    return -1;
+  }
+
+  rs.fd = open_target(filename, &oflags, 0);
+  if(rs.fd == -1) {
+    return -1;
+  }
+
+  // Reads must find data, so extend a short target file with data from the
+  // buffer to cover every read in the trace.
+  if(fstat(rs.fd, &st) == -1) {
+    perror("fstat");
+    return -1;
+  }
+  if(S_ISREG(st.st_mode) && st.st_size < extent) {
+    extent = (extent + chunk_size - 1) / chunk_size * chunk_size;
+    printf("prefilling %lu bytes of %s\n", extent - st.st_size / chunk_size
+        * chunk_size, filename);
+    for(k=st.st_size / chunk_size; k<extent / chunk_size; k++) {
+      if(pwrite(rs.fd, buffer + (k % chunk_count) * alignment, chunk_size,
+            k * chunk_size) != chunk_size) {
+        perror("pwrite[prefill]");
+        return -1;
+      }
+    }
+  }
+
+  for(i=0; run && (i < niters || niters == 0); i++) {
+    rs.iter = i;
+    rs.bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(replay_pass(&rs, eng, speed)) {
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    elapsed_ns = ELAPSED_NS(start, stop);
+
+    time(&now);
+    strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+    printf("%s replayed %lu bytes in %lu ns (%.3f Gbps)"
+        " original duration %lu ns\n", strnow, rs.bytes, elapsed_ns,
+        (8.0 * rs.bytes)/elapsed_ns,
+        recs[rs.nrecs-1].ts_ns - recs[0].ts_ns);
+    fflush(stdout);
+  }
+
+  if(close(rs.fd) == -1) {
+    perror("close");
+    return -1;
+  }
+
+  replay_compare("read", rs.rhist, orig_r);
+  replay_compare("write", rs.whist, orig_w);
+  if(speed > 0) {
+    lat_hist_print("issue lag", rs.lag);
+  }
+
+  free(recs);
+  free(rs.slot_iovs);
+  free(rs.rbufs);
+  free(orig_r);
+  free(orig_w);
+  free(rs.rhist);
+  free(rs.whist);
+  free(rs.lag);
+
+  return 0;
+}
+
+// Tests of the flush microbenchmark
+enum flush_test {
+  flush_write_flush, // Write followed by fdatasync
+  flush_fua,         // O_DSYNC write, which the kernel issues with FUA
+  flush_empty,       // fdatasync with nothing written
+  flush_ntests
+};
+
+static const char * flush_test_names[] = {"write+flush", "fua write",
+  "empty flush"};
+
+// Flush microbenchmark state shared by all threads of one test
+struct flush_state {
+  int fd;
+  int dsync_fd;
+  const char * buffer;
+  enum flush_test test;
+  size_t size;
+  off_t slice;
+  uint64_t nops;
+  int error;
+};
+
+// Per-thread state
+struct flush_thread {
+  pthread_t thread;
+  struct flush_state * fs;
+  int id;
+  struct lat_hist hist;
+};
+
+static void * flush_thread_main(void * arg)
+{
+  struct flush_thread * ft = arg;
+  struct flush_state * fs = ft->fs;
+  uint64_t k;
+  off_t offset;
+  ssize_t rc = 0;
+  struct timespec start, stop;
+
+  for(k=0; k<fs->nops && run &&
+      !__atomic_load_n(&fs->error, __ATOMIC_RELAXED); k++) {
+    // Each thread writes sequentially within its own slice of the file
+    offset = ft->id * fs->slice + (k * fs->size) % fs->slice;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    switch(fs->test) {
+      case flush_write_flush:
+        rc = pwrite(fs->fd, fs->buffer, fs->size, offset);
+        if(rc == fs->size && fdatasync(fs->fd) == -1) {
+          rc = -1;
+        }
+        break;
+      case flush_fua:
+        rc = pwrite(fs->dsync_fd, fs->buffer, fs->size, offset);
+        break;
+      default:
+        rc = fdatasync(fs->fd) == -1 ? -1 : fs->size;
+        break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if(rc != fs->size) {
+      if(rc == -1) {
+        perror(flush_test_names[fs->test]);
+      } else {
+        printf("error: short write of %ld bytes\n", rc);
+      }
+      __atomic_store_n(&fs->error, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    lat_hist_add(&ft->hist, ELAPSED_NS(start, stop));
+  }
+
+  return NULL;
+}
+
+// Runs test with depth threads, each doing nops operations of size bytes,
+// and adds the latencies to hist.  The time taken is stored in *elapsed_ns.
+// Returns 0 on success or -1 on error.
+int flush_cell(struct flush_state * fs, int depth, struct lat_hist * hist,
+    int64_t * elapsed_ns)
+{
+  int i;
+  int rc = 0;
+  struct flush_thread * fts;
+  struct timespec start, stop;
+
+  fts = calloc(depth, sizeof(*fts));
+  if(!fts) {
+    perror("calloc[flush_thread]");
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<depth; i++) {
+    fts[i].fs = fs;
+    fts[i].id = i;
+    if((errno = pthread_create(&fts[i].thread, NULL, flush_thread_main,
+            &fts[i]))) {
+      perror("pthread_create");
+      fs->error = 1;
+      depth = i;
+      rc = -1;
+      break;
+    }
+  }
+  for(i=0; i<depth; i++) {
+    pthread_join(fts[i].thread, NULL);
+    lat_hist_merge(hist, &fts[i].hist);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  *elapsed_ns = ELAPSED_NS(start, stop);
+
+  free(fts);
+
+  return (rc || fs->error) ? -1 : 0;
+}
+
+// Closes the descriptors of fs and frees the flush benchmark buffers after
+// an error
+static void flush_free(struct flush_state * fs, char * wbuf,
+    struct lat_hist * hists)
+{
+  if(fs->fd != -1) {
+    close(fs->fd);
+  }
+  if(fs->dsync_fd != -1) {
+    close(fs->dsync_fd);
+  }
+  free(wbuf);
+  free(hists);
+}
+
+// Runs the flush microbenchmark on the first file_size bytes of filename.
+// Writes come from a separate buffer filled with the first chunk of buffer,
+// repeated.  For every queue depth in depths and write size in sizes, each
+// test of enum flush_test is run with one thread per queue depth doing nops
+// operations.  The empty flush does not depend on the write size, so it is
+// run once per queue depth.  The latencies of all tests are shown side by
+// side.  Returns 0 on success or -1 on error.
+int flush_run(const char * filename, size_t file_size, const char * buffer,
+    int alignment, size_t chunk_size, struct iovec * iovs,
+    const uint64_t * sizes, int nsizes, const uint64_t * depths, int ndepths,
+    uint64_t nops, int verbose)
+{
+  int d, z, t;
+  size_t max_size = 0;
+  char * wbuf;
+  int oflags = O_WRONLY | O_CREAT | O_DIRECT;
+  struct stat st;
+  struct lat_hist * hists;
+  struct lat_hist * h;
+  int64_t elapsed_ns[flush_ntests];
+  char label[64];
+  const char * names[flush_ntests];
+  struct flush_state fs = {
+    .fd = -1,
+    .dsync_fd = -1,
+    .nops = nops
+  };
+
+  for(z=0; z<nsizes; z++) {
+    if(sizes[z] % alignment) {
+      printf("error: flush size %lu is not a multiple of %d bytes\n",
+          sizes[z], alignment);
+      return -1;
+    }
+    if(sizes[z] > max_size) {
+      max_size = sizes[z];
+    }
+  }
+  for(d=0; d<ndepths; d++) {
+    for(z=0; z<nsizes; z++) {
+      if(file_size / depths[d] < sizes[z]) {
+        printf("error: %lu bytes is too small for %lu writes of %lu bytes\n",
+            file_size, depths[d], sizes[z]);
+        return -1;
+      }
+    }
+  }
+
+  hists = calloc(flush_ntests, sizeof(*hists));
+  if(!hists) {
+    perror("calloc[flush hists]");
+    return -1;
+  }
+  if((errno=posix_memalign((void **)&wbuf, alignment, max_size))) {
+    perror("posix_memalign[flush]");
+    free(hists);
+    return -1;
+  }
+  for(z=0; z<max_size; z+=chunk_size) {
+    memcpy(wbuf + z, buffer,
+        max_size - z < chunk_size ? max_size - z : chunk_size);
+  }
+  fs.buffer = wbuf;
+
+  fs.fd = open_target(filename, &oflags, 0);
+  if(fs.fd == -1) {
+    flush_free(&fs, wbuf, hists);
+    return -1;
+  }
+
+  // Overwriting existing blocks keeps block allocation out of the flushes
+  if(fstat(fs.fd, &st) == -1) {
+    perror("fstat");
+    flush_free(&fs, wbuf, hists);
+    return -1;
+  }
+  if(S_ISREG(st.st_mode) && st.st_size < file_size) {
+    printf("prefilling %ld bytes of %s\n", file_size, filename);
+    fflush(stdout);
+    if(write_pass(fs.fd, iovs, file_size / chunk_size, chunk_size, 0, NULL,
+          NULL) || fdatasync(fs.fd) == -1) {
+      flush_free(&fs, wbuf, hists);
+      return -1;
+    }
+  }
+
+  oflags |= O_DSYNC;
+  fs.dsync_fd = open(filename, oflags);
+  if(fs.dsync_fd == -1) {
+    perror(filename);
+    flush_free(&fs, wbuf, hists);
+    return -1;
+  }
+
+  // Without O_DIRECT, O_DSYNC writes go through the page cache and are
+  // flushed separately rather than issued with FUA
+  memcpy(names, flush_test_names, sizeof(names));
+  if(!(oflags & O_DIRECT)) {
+    names[flush_fua] = "dsync write";
+    printf("warning: no O_DIRECT, so the %s test is a buffered O_DSYNC"
+        " write\n", flush_test_names[flush_fua]);
+  }
+
+  printf("%8s %5s", "size", "depth");
+  for(t=0; t<flush_ntests; t++) {
+    snprintf(label, sizeof(label), "%s p50/p99 us (IOPS)", names[t]);
+    printf(" %30s", label);
+  }
+  printf("\n");
+
+  for(d=0; run && d<ndepths; d++) {
+    for(z=0; run && z<nsizes; z++) {
+      fs.size = sizes[z];
+      fs.slice = (file_size / depths[d]) / fs.size * fs.size;
+      for(t=0; run && t<flush_ntests; t++) {
+        if(t == flush_empty && z > 0) {
+          continue;
+        }
+        memset(&hists[t], 0, sizeof(hists[t]));
+        fs.test = t;
+        if(flush_cell(&fs, depths[d], &hists[t], &elapsed_ns[t])) {
+          flush_free(&fs, wbuf, hists);
+          return -1;
+        }
+        if(verbose) {
+          snprintf(label, sizeof(label), "%lu bytes depth %lu %s",
+              fs.size, depths[d], names[t]);
+          lat_hist_print(label, &hists[t]);
+        }
+      }
+      printf("%8lu %5lu", fs.size, depths[d]);
+      for(t=0; t<flush_ntests; t++) {
+        h = &hists[t];
+        snprintf(label, sizeof(label), "%.1f/%.1f (%.0f)",
+            lat_hist_pct(h, 50) / 1e3, lat_hist_pct(h, 99) / 1e3,
+            elapsed_ns[t] ? 1e9 * h->count / elapsed_ns[t] : 0.0);
+        printf(" %30s", label);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+
+  if(close(fs.fd) == -1 || close(fs.dsync_fd) == -1) {
+    perror("close");
+    return -1;
+  }
+  free(hists);
+  free(wbuf);
+
+  return 0;
+}
+
+// Parameter sweep.  Every combination (point) of the chunk sizes, chunk
+// counts, lengths, iodepths and job counts runs SWEEP_WARMUP_ITERS unmeasured
+// iterations followed by the measured iterations.  Each job is a forked
+// process that writes (or reads) its own LENGTH bytes region of the target,
+// and the results of all jobs of a point are combined into one CSV row.
+#ifndef SWEEP_WARMUP_ITERS
+#define SWEEP_WARMUP_ITERS 1
+#endif
+
+struct sweep_point {
+  size_t chunk_size;
+  uint32_t chunk_count;
+  size_t length;
+  int depth; // 0 for the sync engine
+  uint64_t iovs; // Chunks per call with the sync engine, 0 for the default
+  int job;
+};
+
+// Filled in by each job in memory shared with the parent
+struct sweep_result {
+  struct lat_hist hist;
+  uint64_t bytes;
+  int64_t ns;
+  int64_t cpu_ns;
+  int error;
+};
+
+static int64_t rusage_ns(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000L +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000L;
+}
+
+// Runs nwarmup unmeasured and then niters measured iterations of one job of
+// point pt.  Returns 0 on success or -1 on error.
+static int sweep_job(const char * filename, int oflags, const char * buffer,
+    int alignment, const struct sweep_point * pt, int is_read, int nwarmup,
+    int niters, struct sweep_result * res)
+{
+  int i;
+  int fd;
+  uint64_t nchunks = pt->length / pt->chunk_size;
+  uint64_t batch;
+  off_t base = pt->job * pt->length;
+  struct iovec * iovs;
+  char * rbuf;
+  struct aio_engine eng;
+  struct lat_hist warmup = {0};
+  struct lat_hist * hist;
+  struct timespec start, stop;
+  struct write_ctl ctl = {
+    .max_iovs = pt->iovs
+  };
+  int64_t cpu_start = 0;
+  int rc;
+
+  batch = pt->iovs ? pt->iovs : READ_BATCH_BYTES / pt->chunk_size;
+  if(batch > IOV_MAX) {
+    batch = IOV_MAX;
+  } else if(batch == 0) {
+    batch = 1;
+  }
+  if(batch > nchunks) {
+    batch = nchunks;
+  }
+
+  iovs = malloc((nchunks + pt->chunk_count - 1) * sizeof(*iovs));
+  if(!iovs) {
+    perror("malloc[sweep iovs]");
+    return -1;
+  }
+  for(i=0; i<nchunks+pt->chunk_count-1; i++) {
+    iovs[i].iov_base = (char *)buffer + (i % pt->chunk_count) * alignment;
+    iovs[i].iov_len = pt->chunk_size;
+  }
+  if((errno=posix_memalign((void **)&rbuf, alignment,
+          (pt->depth ? pt->depth : batch) * pt->chunk_size))) {
+    perror("posix_memalign[sweep]");
+    return -1;
+  }
+  if(pt->depth && aio_engine_init(&eng, pt->depth)) {
+    return -1;
+  }
+
+  for(i=0; run && i<nwarmup+niters; i++) {
+    if(i == nwarmup) {
+      cpu_start = rusage_ns();
+    }
+    hist = i < nwarmup ? &warmup : &res->hist;
+    fd = open_target(filename, &oflags, i);
+    if(fd == -1) {
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pt->depth) {
+      rc = aio_pass(&eng, fd, is_read, base, &iovs[i % pt->chunk_count],
+          nchunks, pt->chunk_size, rbuf, i, hist, NULL);
+    } else if(lseek(fd, base, SEEK_SET) == -1) {
+      perror("lseek");
+      rc = -1;
+    } else if(is_read) {
+      rc = read_pass(fd, rbuf, batch, nchunks, pt->chunk_size, i, hist, NULL);
+    } else {
+      rc = write_pass(fd, &iovs[i % pt->chunk_count], nchunks,
+          pt->chunk_size, i, hist, &ctl);
+    }
+    if(rc || close(fd) == -1) {
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if(i >= nwarmup) {
+      res->bytes += nchunks * pt->chunk_size;
+      res->ns += ELAPSED_NS(start, stop);
+    }
+  }
+  res->cpu_ns = rusage_ns() - cpu_start;
+
+  return 0;
+}
+
+// Runs njobs jobs of point pt in parallel processes and combines their
+// results into total.  results is shared memory with room for njobs results.
+// Returns 0 on success or -1 on error.
+static int sweep_point_run(const char * filename, int oflags,
+    const char * buffer, int alignment, struct sweep_point * pt, int njobs,
+    int is_read, int nwarmup, int niters, struct sweep_result * results,
+    struct sweep_result * total)
+{
+  int j;
+  int nfailed = 0;
+  int status;
+  pid_t pid;
+
+  memset(results, 0, njobs * sizeof(*results));
+
+  // stdout is flushed first so that buffered output is not repeated by the
+  // children
+  fflush(stdout);
+  for(j=0; j<njobs; j++) {
+    pt->job = j;
+    pid = fork();
+    if(pid == -1) {
+      perror("fork");
+      return -1;
+    } else if(pid == 0) {
+      results[j].error = sweep_job(filename, oflags, buffer, alignment, pt,
+          is_read, nwarmup, niters, &results[j]);
+      _exit(results[j].error ? 1 : 0);
+    }
+  }
+  while(wait(&status) != -1) {
+    if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+      nfailed++;
+    }
+  }
+  if(nfailed) {
+    printf("error: %d jobs failed\n", nfailed);
+    return -1;
+  }
+
+  // Jobs run concurrently, so throughput is based on the slowest job
+  memset(total, 0, sizeof(*total));
+  for(j=0; j<njobs; j++) {
+    lat_hist_merge(&total->hist, &results[j].hist);
+    total->bytes += results[j].bytes;
+    total->cpu_ns += results[j].cpu_ns;
+    if(results[j].ns > total->ns) {
+      total->ns = results[j].ns;
+    }
+  }
+
+  return 0;
+}
+
+// Writes the first length bytes of filename for reads by later jobs, unless
+// it is a regular file that is long enough or not a regular file.  Returns 0
+// on success or -1 on error.
+static int sweep_prefill(const char * filename, const char * buffer,
+    int alignment, const struct dh_opts * opts, uint64_t length)
+{
+  int oflags = O_WRONLY | O_CREAT |
+    io_mode_flags[opts->io >= 0 ? opts->io : io_direct];
+  struct stat st;
+  struct sweep_result res;
+  struct sweep_point pt = {
+    .chunk_size = opts->sweep_sizes[0],
+    .chunk_count = opts->sweep_counts[0]
+  };
+
+  pt.length = length / pt.chunk_size * pt.chunk_size;
+  if(stat(filename, &st) == 0 &&
+      (!S_ISREG(st.st_mode) || st.st_size >= pt.length)) {
+    return 0;
+  }
+  printf("prefilling %lu bytes of %s\n", pt.length, filename);
+  fflush(stdout);
+  memset(&res, 0, sizeof(res));
+  return sweep_job(filename, oflags, buffer, alignment, &pt, 0, 0, 1, &res);
+}
+
+// Runs the sweep over the given lists, with the other parameters taken from
+// opts.  buffer holds enough random data for the largest chunk size and
+// count.  Returns 0 on success or -1 on error.
+int sweep_run(const char * filename, const char * buffer, int alignment,
+    const struct dh_opts * opts, const uint64_t * lengths, int nlengths,
+    int niters)
+{
+  int j;
+  int k;
+  int p;
+  int npoints;
+  int njobs;
+  int oflags;
+  struct sweep_point pt;
+  struct sweep_result * results;
+  struct sweep_result total;
+  uint64_t max_length = 0;
+  uint64_t max_jobs = 0;
+
+  for(j=0; j<opts->nsweep_sizes; j++) {
+    if(opts->sweep_sizes[j] % alignment) {
+      printf("error: chunk size %lu is not a multiple of %d bytes\n",
+          opts->sweep_sizes[j], alignment);
+      return -1;
+    }
+    for(k=0; k<nlengths; k++) {
+      if(lengths[k] < opts->sweep_sizes[j]) {
+        printf("error: length %lu is smaller than chunk size %lu\n",
+            lengths[k], opts->sweep_sizes[j]);
+        return -1;
+      }
+      if(lengths[k] > max_length) {
+        max_length = lengths[k];
+      }
+    }
+  }
+  for(j=0; j<opts->nsweep_jobs; j++) {
+    if(opts->sweep_jobs[j] > max_jobs) {
+      max_jobs = opts->sweep_jobs[j];
+    }
+  }
+
+  results = mmap(NULL, max_jobs * sizeof(*results), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(results == MAP_FAILED) {
+    perror("mmap[sweep]");
+    return -1;
+  }
+
+  // Reads need data in the regions of all jobs
+  if(opts->read_mode && sweep_prefill(filename, buffer, alignment, opts,
+        max_length * max_jobs)) {
+    return -1;
+  }
+
+  oflags = (opts->read_mode ? O_RDONLY : O_WRONLY | O_CREAT) |
+    io_mode_flags[opts->io >= 0 ? opts->io : io_direct];
+
+  printf("size,count,length,iodepth,jobs,gbps,iops,p50_ns,p90_ns,p99_ns,"
+      "p999_ns,max_ns,cpu_pct,cpu_us_per_mib\n");
+  fflush(stdout);
+
+  // Points are numbered with the job count varying fastest
+  npoints = opts->nsweep_sizes * opts->nsweep_counts * nlengths *
+    opts->nsweep_depths * opts->nsweep_jobs;
+  for(p=0; run && p<npoints; p++) {
+    k = p;
+    njobs = opts->sweep_jobs[k % opts->nsweep_jobs];
+    k /= opts->nsweep_jobs;
+    pt.depth = opts->engine == engine_aio ?
+      opts->sweep_depths[k % opts->nsweep_depths] : 0;
+    k /= opts->nsweep_depths;
+    pt.length = lengths[k % nlengths];
+    k /= nlengths;
+    pt.chunk_count = opts->sweep_counts[k % opts->nsweep_counts];
+    k /= opts->nsweep_counts;
+    pt.chunk_size = opts->sweep_sizes[k];
+    pt.length = pt.length / pt.chunk_size * pt.chunk_size;
+    pt.iovs = opts->iovs;
+
+    if(sweep_point_run(filename, oflags, buffer, alignment, &pt, njobs,
+          opts->read_mode, opts->warmup ? opts->warmup_iters :
+          SWEEP_WARMUP_ITERS, niters, results, &total)) {
+      return -1;
+    }
+    if(!run) {
+      break;
+    }
+
+    printf("%lu,%u,%lu,%d,%d,%.3f,%.0f,%lu,%lu,%lu,%lu,%lu,%.1f,%.1f\n",
+        pt.chunk_size, pt.chunk_count, pt.length, pt.depth ? pt.depth : 1,
+        njobs, 8.0 * total.bytes / total.ns,
+        1e9 * total.bytes / pt.chunk_size / total.ns,
+        lat_hist_pct(&total.hist, 50), lat_hist_pct(&total.hist, 90),
+        lat_hist_pct(&total.hist, 99), lat_hist_pct(&total.hist, 99.9),
+        total.hist.max_ns, 100.0 * total.cpu_ns / total.ns,
+        total.cpu_ns / 1e3 / (total.bytes / (double)MiB));
+    fflush(stdout);
+  }
+
+  munmap(results, max_jobs * sizeof(*results));
+  return 0;
+}
+
+// Automatic tuning.  Each trial runs one warmup and one measured iteration
+// over the first AUTOTUNE_TRIAL_BYTES (or LENGTH if smaller) of the target.
+// The first stage tries chunk sizes from the alignment up to
+// AUTOTUNE_MAX_SIZE.  The second stage tries, with the best chunk size,
+// chunks per call (sync engine) or queue depths (aio engine) from 1 up to
+// IOV_MAX or AUTOTUNE_MAX_DEPTH, going up by factors of 4 or 2.  The fastest
+// trial whose p99 latency is within the limit wins.
+#ifndef AUTOTUNE_TRIAL_BYTES
+#define AUTOTUNE_TRIAL_BYTES (64*MiB)
+#endif
+
+#ifndef AUTOTUNE_MAX_SIZE
+#define AUTOTUNE_MAX_SIZE (1*MiB)
+#endif
+
+#ifndef AUTOTUNE_MAX_DEPTH
+#define AUTOTUNE_MAX_DEPTH 256
+#endif
+
+// Runs one trial of pt with nwarmup warmup iterations and shows the result.
+// Returns 0 on success or -1 on error.
+static int autotune_trial(const char * filename, int oflags,
+    const char * buffer, int alignment, struct sweep_point * pt, int is_read,
+    int nwarmup, struct sweep_result * res)
+{
+  struct sweep_result total;
+  char per_call[24] = "max";
+
+  if(sweep_point_run(filename, oflags, buffer, alignment, pt, 1, is_read,
+        nwarmup, 1, res, &total)) {
+    return -1;
+  }
+  *res = total;
+  if(pt->depth || pt->iovs) {
+    snprintf(per_call, sizeof(per_call), "%lu",
+        pt->depth ? (uint64_t)pt->depth : pt->iovs);
+  }
+  printf("%8lu %6s %10.3f %10lu\n", pt->chunk_size, per_call,
+      8.0 * total.bytes / total.ns, lat_hist_pct(&total.hist, 99));
+  fflush(stdout);
+  return 0;
+}
+
+// Returns true if res is better than best given the latency limit p99_ns (0
+// for none).  Trials within the limit beat those over it, faster trials beat
+// slower ones and, over the limit, lower latency beats higher.
+static int autotune_better(const struct sweep_result * res,
+    const struct sweep_result * best, uint64_t p99_ns)
+{
+  uint64_t p99 = lat_hist_pct(&res->hist, 99);
+  uint64_t best_p99 = lat_hist_pct(&best->hist, 99);
+  int ok = !p99_ns || p99 <= p99_ns;
+  int best_ok = !p99_ns || best_p99 <= p99_ns;
+
+  if(!best->ns || ok != best_ok) {
+    return !best->ns || ok;
+  } else if(ok) {
+    return (double)res->bytes / res->ns > (double)best->bytes / best->ns;
+  }
+  return p99 < best_p99;
+}
+
+// Searches for the best chunk size and chunks per call or queue depth for
+// filename, with the chunk count and I/O mode from opts.  buffer must hold
+// AUTOTUNE_MAX_SIZE bytes plus opts->chunk_count-1 alignments.  best is set
+// to the winning point.  Returns 0 on success or -1 on error, including no
+// trial meeting the latency limit.
+int autotune(const char * filename, const char * buffer, int alignment,
+    const struct dh_opts * opts, uint64_t length, struct sweep_point * best)
+{
+  int oflags;
+  int stage;
+  uint64_t v;
+  uint64_t p99_ns = opts->autotune_p99 * 1e9 + 0.5;
+  struct sweep_point pt = {0};
+  struct sweep_result * res;
+  struct sweep_result best_res = {0};
+
+  if(length > AUTOTUNE_TRIAL_BYTES) {
+    length = AUTOTUNE_TRIAL_BYTES;
+  }
+  res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(res == MAP_FAILED) {
+    perror("mmap[autotune]");
+    return -1;
+  }
+  if(opts->read_mode && sweep_prefill(filename, buffer, alignment, opts,
+        length)) {
+    return -1;
+  }
+  oflags = (opts->read_mode ? O_RDONLY : O_WRONLY | O_CREAT) |
+    io_mode_flags[opts->io >= 0 ? opts->io : io_direct];
+
+  printf("%8s %6s %10s %10s\n", "size",
+      opts->engine == engine_aio ? "depth" : "iovs", "Gbps", "p99 ns");
+  *best = pt;
+  pt.chunk_count = opts->chunk_count;
+  pt.depth = opts->engine == engine_aio ? opts->iodepth : 0;
+  pt.iovs = opts->iovs;
+  for(stage=0; stage<2; stage++) {
+    for(v=stage ? 1 : alignment; run; v*=(stage && !pt.depth) ? 4 : 2) {
+      if(stage == 0) {
+        if(v > AUTOTUNE_MAX_SIZE || v > length) {
+          break;
+        }
+        pt.chunk_size = v;
+      } else if(pt.depth) {
+        if(v > AUTOTUNE_MAX_DEPTH) {
+          break;
+        }
+        pt.depth = v;
+      } else {
+        pt.iovs = v < IOV_MAX ? v : IOV_MAX;
+      }
+      pt.length = length / pt.chunk_size * pt.chunk_size;
+      if(autotune_trial(filename, oflags, buffer, alignment, &pt,
+            opts->read_mode, opts->warmup_secs == 0 && opts->warmup ?
+            opts->warmup_iters : SWEEP_WARMUP_ITERS, res)) {
+        return -1;
+      }
+      if(autotune_better(res, &best_res, p99_ns)) {
+        best_res = *res;
+        *best = pt;
+      }
+      if(stage && pt.iovs == IOV_MAX) {
+        break;
+      }
+    }
+    // The second stage starts from the best chunk size
+    pt = *best;
+  }
+  munmap(res, sizeof(*res));
+  if(!run) {
+    return -1;
+  }
+
+  printf("best: -s %lu", best->chunk_size);
+  if(best->depth) {
+    printf(" --iodepth=%d", best->depth);
+  } else if(best->iovs) {
+    printf(" --iovs=%lu", best->iovs);
+  }
+  printf(" at %.3f Gbps, p99 %lu ns\n", 8.0 * best_res.bytes / best_res.ns,
+      lat_hist_pct(&best_res.hist, 99));
+  if(p99_ns && lat_hist_pct(&best_res.hist, 99) > p99_ns) {
+    printf("error: no configuration met the p99 latency limit of %lu ns\n",
+        p99_ns);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Results and regression tracking.  --json appends one line per run to a
+// file holding the per-iteration throughput and the latency summaries, and
+// --bench runs a fixed suite of workloads, each as a child run of this
+// program with --json, collecting the runs into one file.  --compare reads
+// two such files and flags significant changes between runs of the same
+// mode.
+
+// Latency summaries shown at the end of the run, kept for --json
+#define SUMMARY_MAX 8
+static const char * summary_labels[SUMMARY_MAX];
+static const struct lat_hist * summary_hists[SUMMARY_MAX];
+static int nsummary = 0;
+
+static void summary_print(const char * label, const struct lat_hist * h)
+{
+  lat_hist_print(label, h);
+  if(nsummary < SUMMARY_MAX) {
+    summary_labels[nsummary] = label;
+    summary_hists[nsummary++] = h;
+  }
+}
+
+// Writes s to f with the escapes needed inside a JSON string
+static void json_chars(FILE * f, const char * s)
+{
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\') {
+      fprintf(f, "\\%c", *s);
+    } else if((unsigned char)*s < 0x20) {
+      fprintf(f, "\\u%04x", *s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+}
+
+// Writes s to f as a JSON string
+static void json_string(FILE * f, const char * s)
+{
+  fputc('"', f);
+  json_chars(f, s);
+  fputc('"', f);
+}
+
+// Appends a run to path as one line of JSON: the mode, command line,
+// measured (non-warmup) iteration throughputs in Gbps and the latency
+// summaries.  The first latency summary is the primary one for the mode.
+// Returns 0 on success or -1 on error.
+int json_result(const char * path, const char * mode, int argc,
+    char * argv[], const double * gbps, int n)
+{
+  int i;
+  int first;
+  FILE * f;
+  double mean = 0;
+  double var = 0;
+  const struct lat_hist * h;
+
+  for(i=0; i<n; i++) {
+    mean += gbps[i] / n;
+  }
+  for(i=0; i<n; i++) {
+    var += (gbps[i] - mean) * (gbps[i] - mean);
+  }
+  if(n > 1) {
+    var /= n - 1;
+  }
+
+  f = fopen(path, "a");
+  if(!f) {
+    perror("fopen[json]");
+    return -1;
+  }
+  fprintf(f, "{\"mode\": ");
+  json_string(f, mode);
+  fprintf(f, ", \"args\": \"");
+  for(i=1, first=1; i<argc; i++) {
+    // Everything but the --json option itself
+    if(!strcmp(argv[i], "--json")) {
+      i++;
+    } else if(strncmp(argv[i], "--json=", 7)) {
+      fprintf(f, "%s", first ? "" : " ");
+      json_chars(f, argv[i]);
+      first = 0;
+    }
+  }
+  fprintf(f, "\", \"iters\": %d, \"gbps\": [", n);
+  for(i=0; i<n; i++) {
+    fprintf(f, "%s%.6f", i ? ", " : "", gbps[i]);
+  }
+  fprintf(f, "], \"mean_gbps\": %.6f, \"stdev_gbps\": %.6f, \"latency\": {",
+      mean, sqrt(var));
+  for(i=0; i<nsummary; i++) {
+    h = summary_hists[i];
+    fprintf(f, "%s", i ? ", " : "");
+    json_string(f, summary_labels[i]);
+    fprintf(f, ": {\"count\": %lu, \"min\": %lu, \"avg\": %.0f, \"p50\": %lu,"
+        " \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+        h->count, h->min_ns, h->count ? h->sum_ns / h->count : 0.0,
+        lat_hist_pct(h, 50), lat_hist_pct(h, 90), lat_hist_pct(h, 99),
+        lat_hist_pct(h, 99.9), h->max_ns);
+  }
+  fprintf(f, "}}\n");
+  if(fclose(f)) {
+    perror("fclose[json]");
+    return -1;
+  }
+  return 0;
+}
+
+// The --bench suite.  Each workload runs against the bench target, or for
+// the metadata workload a directory next to it, which is skipped when the
+// target is a block device.  args hold the options (as single arguments),
+// LENGTH and ITERS.
+#define BENCH_ARGS_MAX 8
+
+struct bench_workload {
+  const char * name;
+  const char * suffix; // Appended to the target for FILE
+  int skip_blk;
+  const char * args[BENCH_ARGS_MAX]; // NULL terminated
+};
+
+static const struct bench_workload bench_suite[] = {
+  {"sequential write", "", 0,
+    {"--size=1m", "--iovs=1", "--warmup=1", "256m", "6"}},
+  {"random 4K write", "", 0,
+    {"--rmw=4k", "--warmup=1", "64m", "6"}},
+  {"sync append", "", 0,
+    {"--wal=4k", "--warmup=1", "4m", "6"}},
+  {"metadata storm", ".d", 1,
+    {"--files=2000", "--fsync", "--unlink", "--warmup=1", "4k", "6"}},
+};
+
+#define BENCH_NWORKLOADS (sizeof(bench_suite) / sizeof(bench_suite[0]))
+
+// Removes one entry of a scratch tree walked depth first by nftw
+static int bench_remove(const char * path, const struct stat * st, int type,
+    struct FTW * ftw)
+{
+  if(remove(path)) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+// Runs the bench suite against target, writing the results to out.  Each
+// workload is a child run of this program that appends its line to out.  The
+// scratch directory of a workload with a suffix is removed after it has run,
+// and a regular file target after the suite.  Returns 0 on success or -1 if
+// any workload failed.
+int bench_run(const char * argv0, const char * target, const char * out,
+    int verbose)
+{
+  int i, j, k;
+  int status;
+  int failed = 0;
+  int is_blk;
+  int nruns = 0;
+  pid_t pid;
+  FILE * f;
+  struct stat st;
+  struct utsname uts;
+  time_t now;
+  off_t size;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC")];
+  char path[PATH_MAX];
+  char json_opt[PATH_MAX + 8];
+  const char * args[BENCH_ARGS_MAX + 4];
+
+  is_blk = stat(target, &st) == 0 && S_ISBLK(st.st_mode);
+  if(uname(&uts)) {
+    perror("uname");
+    return -1;
+  }
+  time(&now);
+  strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+
+  f = fopen(out, "w");
+  if(!f) {
+    perror("fopen[bench]");
+    return -1;
+  }
+  fprintf(f, "{\"target\": ");
+  json_string(f, target);
+  fprintf(f, ", \"date\": ");
+  json_string(f, strnow);
+  fprintf(f, ", \"kernel\": ");
+  json_string(f, uts.release);
+  fprintf(f, ", \"runs\": [\n");
+  fclose(f);
+  snprintf(json_opt, sizeof(json_opt), "--json=%s", out);
+
+  for(i=0; i<BENCH_NWORKLOADS && run; i++) {
+    if(is_blk && bench_suite[i].skip_blk) {
+      printf("bench: skipping %s on block device %s\n", bench_suite[i].name,
+          target);
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s%s", target, bench_suite[i].suffix);
+    j = 0;
+    args[j++] = argv0;
+    args[j++] = json_opt;
+    if(verbose) {
+      args[j++] = "-v";
+    }
+    // Options first, then FILE before LENGTH and ITERS
+    for(k=0; bench_suite[i].args[k][0] == '-'; k++) {
+      args[j++] = bench_suite[i].args[k];
+    }
+    args[j++] = path;
+    for(; bench_suite[i].args[k]; k++) {
+      args[j++] = bench_suite[i].args[k];
+    }
+    args[j] = NULL;
+
+    // Runs after the first are separated by a comma
+    size = stat(out, &st) ? 0 : st.st_size;
+    if(nruns) {
+      f = fopen(out, "a");
+      if(!f) {
+        perror("fopen[bench]");
+        return -1;
+      }
+      fputc(',', f);
+      fclose(f);
+    }
+
+    printf("bench: %s\n", bench_suite[i].name);
+    fflush(stdout);
+    pid = fork();
+    if(pid == -1) {
+      perror("fork");
+      return -1;
+    } else if(pid == 0) {
+      execv("/proc/self/exe", (char * const *)args);
+      perror("execv");
+      _exit(127);
+    }
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+      printf("bench: %s failed\n", bench_suite[i].name);
+      failed++;
+    }
+    if(*bench_suite[i].suffix && nftw(path, bench_remove, 16,
+          FTW_DEPTH | FTW_PHYS) && errno != ENOENT) {
+      failed++;
+    }
+    if(stat(out, &st) == 0 && st.st_size > size + (nruns ? 1 : 0)) {
+      nruns++;
+    } else if(nruns) {
+      // Drop the separator of a run that recorded nothing
+      if(truncate(out, size)) {
+        perror("truncate[bench]");
+        return -1;
+      }
+    }
+  }
+
+  f = fopen(out, "a");
+  if(!f) {
+    perror("fopen[bench]");
+    return -1;
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+  if(!is_blk && unlink(target) && errno != ENOENT) {
+    perror("unlink[bench]");
+  }
+
+  printf("bench: %d of %lu workloads recorded in %s\n", nruns,
+      BENCH_NWORKLOADS, out);
+  return failed || !run ? -1 : 0;
+}
+
+// --compare thresholds.  A throughput change is significant when Welch's t
+// statistic for the per-iteration throughputs of the two runs exceeds
+// COMPARE_T in magnitude.  A change of the primary p99 latency is
+// significant when it exceeds COMPARE_LATENCY_PCT percent.
+#ifndef COMPARE_T
+#define COMPARE_T 2.0
+#endif
+
+#ifndef COMPARE_LATENCY_PCT
+#define COMPARE_LATENCY_PCT 20
+#endif
+
+#define COMPARE_MAX_RUNS 64
+
+struct bench_result {
+  char mode[16];
+  int n;
+  double mean;
+  double stdev;
+  uint64_t p99;
+};
+
+// Returns the number following key in s, or 0 if key is not found
+static double json_number(const char * s, const char * key)
+{
+  const char * p = strstr(s, key);
+
+  return p ? strtod(p + strlen(key), NULL) : 0;
+}
+
+// Loads up to max runs written by --json or --bench from path.  Returns the
+// number of runs loaded or -1 on error.
+static int bench_load(const char * path, struct bench_result * runs, int max)
+{
+  int n = 0;
+  FILE * f;
+  char * line = NULL;
+  size_t len = 0;
+  const char * p;
+  const char * q;
+  char * end;
+
+  f = fopen(path, "r");
+  if(!f) {
+    perror("fopen[compare]");
+    return -1;
+  }
+  while(n < max && getline(&line, &len, f) != -1) {
+    p = strstr(line, "{\"mode\": \"");
+    if(!p || !(q = strchr(p += strlen("{\"mode\": \""), '"'))) {
+      continue;
+    }
+    snprintf(runs[n].mode, sizeof(runs[n].mode), "%.*s", (int)(q - p), p);
+    runs[n].n = 0;
+    p = strstr(q, "\"gbps\": [");
+    for(p = p ? p + strlen("\"gbps\": [") : q; *p != ']'; runs[n].n++) {
+      strtod(p, &end);
+      if(end == p) {
+        break;
+      }
+      p = end + strspn(end, ", ");
+    }
+    runs[n].mean = json_number(q, "\"mean_gbps\": ");
+    runs[n].stdev = json_number(q, "\"stdev_gbps\": ");
+    runs[n].p99 = json_number(q, "\"p99\": ");
+    n++;
+  }
+  free(line);
+  fclose(f);
+  if(n == 0) {
+    printf("error: no runs found in %s\n", path);
+    return -1;
+  }
+  return n;
+}
+
+// Compares the runs in results with those of the same mode in baseline.
+// Returns the number of significant regressions or -1 on error.
+int bench_compare(const char * baseline, const char * results)
+{
+  int i, j;
+  int nbase, ncur;
+  int nregressed = 0;
+  int used[COMPARE_MAX_RUNS] = {0};
+  double se;
+  double t;
+  double dlat;
+  const char * verdict;
+  struct bench_result base[COMPARE_MAX_RUNS];
+  struct bench_result cur[COMPARE_MAX_RUNS];
+
+  nbase = bench_load(baseline, base, COMPARE_MAX_RUNS);
+  ncur = bench_load(results, cur, COMPARE_MAX_RUNS);
+  if(nbase < 0 || ncur < 0) {
+    return -1;
+  }
+
+  printf("%-6s %10s %10s %8s %7s %12s %12s %8s\n", "mode", "base Gbps",
+      "new Gbps", "change", "t", "base p99 ns", "new p99 ns", "change");
+  for(i=0; i<nbase; i++) {
+    // Runs of the same mode are paired in order
+    for(j=0; j<ncur && (used[j] || strcmp(base[i].mode, cur[j].mode)); j++) {
+    }
+    if(j == ncur) {
+      printf("%-6s missing from %s\n", base[i].mode, results);
+      continue;
+    }
+    used[j] = 1;
+
+    // Significance needs the spread of at least two iterations per run
+    se = sqrt(base[i].stdev * base[i].stdev / base[i].n +
+        cur[j].stdev * cur[j].stdev / cur[j].n);
+    if(base[i].n < 2 || cur[j].n < 2) {
+      t = NAN;
+    } else if(se > 0) {
+      t = (cur[j].mean - base[i].mean) / se;
+    } else {
+      t = cur[j].mean == base[i].mean ? 0 :
+        copysign(INFINITY, cur[j].mean - base[i].mean);
+    }
+    dlat = base[i].p99 ?
+      100.0 * ((double)cur[j].p99 / base[i].p99 - 1) : 0;
+
+    if(t < -COMPARE_T || dlat > COMPARE_LATENCY_PCT) {
+      verdict = "REGRESSION";
+      nregressed++;
+    } else if(t > COMPARE_T || dlat < -COMPARE_LATENCY_PCT) {
+      verdict = "improved";
+    } else {
+      verdict = "";
+    }
+    printf("%-6s %10.3f %10.3f %+7.1f%% ", base[i].mode, base[i].mean,
+        cur[j].mean, base[i].mean ? 100 * (cur[j].mean / base[i].mean - 1) :
+        0.0);
+    if(isnan(t)) {
+      printf("%7s", "n/a");
+    } else {
+      printf("%7.2f", t);
+    }
+    printf(" %12lu %12lu %+7.1f%% %s\n", base[i].p99, cur[j].p99, dlat,
+        verdict);
+  }
+  for(j=0; j<ncur; j++) {
+    if(!used[j]) {
+      printf("%-6s not in baseline %s\n", cur[j].mode, baseline);
+    }
+  }
+  printf("%d of %d runs regressed (|t| > %.1f or p99 change > %d%%)\n",
+      nregressed, nbase, COMPARE_T, COMPARE_LATENCY_PCT);
+
+  return nregressed;
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+  int fd;
+  int argi;
+  int oflags;
+  int niters;
+  size_t file_size;
+  size_t buffer_size;
+  uint64_t file_chunks;
+  int alignment;
+  char * buffer;
+  char * rbuf = NULL;
+  uint64_t lengths[LIST_MAX];
+  int nlengths;
+  size_t max_size;
+  uint64_t max_count;
+  struct sweep_point tuned;
+  size_t rbuf_size = 0;
+  uint64_t read_batch = 0;
+  const char * verb;
+  const char * prep;
+  struct iovec * iovs;
+  struct iovec * piov;
+  struct stat st;
+  struct lat_hist * whist;
+  struct lat_hist * rhist = NULL;
+  struct rw_totals rtot, wtot, dtot;
+  struct lat_hist * dhist = NULL;
+  unsigned short discard_xsubi[3] = {
+    0x1234, SEED & 0xffff, (SEED >> 16) & 0xffff
+  };
+  struct aio_engine eng;
+  uint64_t wal_records = 0;
+  uint64_t wal_syncs;
+  static const char * wal_sync_names[] = {"fdatasync", "dsync", "rwf_dsync"};
+  struct meta_hists * mhists = NULL;
+  struct lat_hist * shist = NULL;
+  struct write_ctl wctl = {0};
+  struct bad_map bad = {0};
+  struct watchdog watchdog = {0};
+  struct pacer rate_pacer = {0};
+  struct depth_ctl adaptive = {0};
+  struct arrivals arrivals = {0};
+  int ab_oflags[2];
+  int nconfigs = 1;
+  int ab;
+  struct rw_totals abtot[2] = {{0}};
+  const char * ab_label = "";
+  int64_t sync_ns;
+  static const char * sync_call_names[] = {
+    "fsync", "fdatasync", "sync_file_range"
+  };
+  uint64_t rmw_bytes = 0;
+  dev_t stats_dev = 0;
+  int have_stats = 0;
+  struct dh_diskstats ds_start, ds_stop;
+  unsigned short rmw_xsubi[3] = {0x4d57, SEED & 0xffff, (SEED >> 16) & 0xffff};
+  char dirpath[PATH_MAX];
+  struct verify_state vstate;
+  unsigned short mix_xsubi[3] = {0x330e, SEED & 0xffff, (SEED >> 16) & 0xffff};
+  unsigned int seed;
+  const char * mode = "";
+  struct dh_state state = {0};
+  int first_iter = 0;
+  uint64_t iter_bytes;
+  uint64_t iter_total;
+  uint64_t total_bytes = 0;
+  int stop_reached = 0;
+  struct timespec run_start, last_report, report_ts;
+  double run_secs;
+  double report_secs;
+  double rate_ewma = 0;
+  double eta;
+  char streta[32];
+  double duty_secs = 0;
+  double iter_gbps;
+  double idle_gbps = 0;
+  int after_idle = 0;
+  int warming = 0;
+  double * json_gbps = NULL;
+  int njson_gbps = 0;
+  int nidle = 0;
+  int nrecovered = 0;
+  double recovery_sum = 0;
+  struct timespec idle;
+  char * filename;
+  char * slash;
+  struct timespec start, stop;
+  int64_t elapsed_ns;
+  struct dh_opts opts;
+  time_t now;
+  char strnow[sizeof("YYYY-dd-mm HH:MM:SS UTC warmup") + 1];
+  struct sigaction sigact = {
+    .sa_handler = signal_handler
+  };
+#if HAVE_ZLIB
+  uint32_t cksum;
+#endif
+
+  argi = parse_command_line(argc, argv, &opts);
+
+  if(argi < 1) {
+    return -argi;
+  }
+
+  filename = argv[argi];
+
+  // The bench suite runs its workloads as child runs of this program
+  if(opts.bench) {
+    return bench_run(argv[0], filename, opts.bench, opts.verbose) ? 1 : 0;
+  } else if(opts.compare) {
+    return bench_compare(opts.compare, filename) ? 1 : 0;
+  }
+
+  file_size = 512 * MiB; // Default filesize 512 MiB
+  if(argc > argi+1) {
+    file_size = strtosize(argv[argi+1]);
+    if(!opts.sweep && strpbrk(argv[argi+1], ",-")) {
+      printf("error: LENGTH lists and ranges require --sweep\n");
+      return 1;
+    }
   }
 
-  niters = 1;
+  // Without ITERS, --total-bytes and --runtime alone decide when to stop
+  niters = (opts.total_bytes || opts.runtime > 0) ? 0 : 1;
   if(argc > argi+2) {
     niters = strtol(argv[argi+2], NULL, 0);
   }
 
+  // Each sweep point runs ITERS measured iterations, so there must be some
+  if(opts.sweep && niters == 0) {
+    printf("error: --sweep needs at least one iteration\n");
+    return 1;
+  }
+
+  // Warmup iterations are part of ITERS, except in sweeps and autotuning
+  if(niters && opts.warmup_iters >= niters && !opts.sweep &&
+      !(opts.autotune && !opts.autotune_run)) {
+    printf("error: %d warmup iterations leave none of %d to measure\n",
+        opts.warmup_iters, niters);
+    return 1;
+  }
+
+  // The metadata workload writes one chunk per file and replay mode takes
+  // its extent from the trace, so LENGTH is ignored
+  if(opts.files || opts.replay) {
+    file_size = opts.chunk_size;
+  }
+
   // Number of chunks per file
   file_chunks = file_size / opts.chunk_size;
   // Adjust file_size (in case file_size was non-multiple of chunk size)
@@ -439,7 +6261,7 @@ int main(int argc, char *argv[])
   if(file_size == 0) {
     printf("error: requested file size is smaller than chunk size\n");
     return 1;
-  } else if(file_chunks < opts.chunk_count) {
+  } else if(file_chunks < opts.chunk_count && !opts.files && !opts.replay) {
     printf("warning: requested file size smaller than all unique chunks\n");
   }
 
@@ -448,12 +6270,61 @@ int main(int argc, char *argv[])
         opts.chunk_count, opts.chunk_size);
   }
 
-  if(niters == 0) {
-    printf("writing %ld bytes to %s infinite times\n",
-        file_size, filename);
+  // Describe the run.  The write, read and similar loops share one format,
+  // with verb and prep (the preposition before FILE) chosen by mode.
+  verb = "writing";
+  prep = "to";
+  if(opts.files) {
+    mode = "files";
+  } else if(opts.wal_record) {
+    verb = "appending";
+    mode = "wal";
+  } else if(opts.rmw_min) {
+    verb = "overwriting records in";
+    prep = "of";
+    mode = "rmw";
+  } else if(opts.read_mode) {
+    verb = "reading";
+    prep = "from";
+    mode = "read";
+  } else if(opts.rwmix >= 0) {
+    verb = "mixing";
+    mode = "rwmix";
+  } else {
+    mode = "write";
+  }
+  if(opts.flush_ops) {
+    printf("flush benchmark on %ld bytes of %s", file_size, filename);
+  } else if(opts.replay) {
+    printf("replaying %s against %s", opts.replay, filename);
+  } else if(opts.fill > 0) {
+    printf("filling %s to %.1f%% full with %ld byte segments", filename,
+        opts.fill, file_size);
+  } else if(opts.files) {
+    printf("creating %lu files of %lu bytes in %s", opts.files,
+        opts.chunk_size, filename);
+  } else {
+    printf("%s %ld bytes %s %s", verb, file_size, prep, filename);
+  }
+  if(opts.fill > 0 || opts.replay || opts.flush_ops) {
+    printf("\n");
+  } else if(niters == 0) {
+    printf(" infinite times\n");
   } else {
-    printf("writing %ld bytes to %s %d times\n",
-        file_size, filename, niters);
+    printf(" %d times\n", niters);
+  }
+  if(opts.rwmix >= 0) {
+    printf("using %d%% reads and %d%% writes\n", opts.rwmix, 100-opts.rwmix);
+  }
+  if(opts.rmw_min) {
+    printf("using %lu records of %lu to %lu bytes per iteration\n",
+        file_chunks, opts.rmw_min, opts.rmw_max);
+  }
+  if(opts.wal_record) {
+    wal_records = file_size / opts.wal_record;
+    printf("using %lu records of %lu bytes, %d committers and %s\n",
+        wal_records, opts.wal_record, opts.committers,
+        wal_sync_names[opts.wal_sync]);
   }
 
   // Use pathconf to find required/recommended I/O alignment, if any
@@ -492,6 +6363,77 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  // Autotuning replaces the chunk size and iovs or iodepth, then either
+  // exits or carries on with the new settings
+  if(opts.autotune) {
+    buffer_size = AUTOTUNE_MAX_SIZE + (opts.chunk_count-1) * alignment;
+    if((errno=posix_memalign((void **)&buffer, alignment, buffer_size))) {
+      perror("posix_memalign[autotune]");
+      return 1;
+    }
+    srandom(SEED);
+    for(i=0; i < buffer_size; i++) {
+      buffer[i] = random() % 0xff;
+    }
+    opts.sweep_sizes[0] = alignment;
+    sigaction(SIGINT, &sigact, NULL);
+    if(autotune(filename, buffer, alignment, &opts, file_size, &tuned)) {
+      return 1;
+    }
+    free(buffer);
+    if(!opts.autotune_run) {
+      return 0;
+    }
+    opts.chunk_size = tuned.chunk_size;
+    opts.iovs = tuned.iovs;
+    if(tuned.depth) {
+      opts.iodepth = tuned.depth;
+    }
+    file_chunks = file_size / opts.chunk_size;
+    file_size = file_chunks * opts.chunk_size;
+    printf("continuing with %lu byte chunks\n", opts.chunk_size);
+  }
+
+  // The sweep has its own loop and a buffer big enough for the largest chunk
+  // size and count
+  if(opts.sweep) {
+    nlengths = argc > argi+1 ?
+      parse_size_list(argv[argi+1], lengths, LIST_MAX) : 1;
+    if(nlengths <= 0) {
+      printf("error: invalid LENGTH list %s\n", argv[argi+1]);
+      return 1;
+    }
+    if(argc <= argi+1) {
+      lengths[0] = file_size;
+    }
+    max_size = 0;
+    max_count = 0;
+    for(i=0; i<opts.nsweep_sizes; i++) {
+      if(opts.sweep_sizes[i] > max_size) {
+        max_size = opts.sweep_sizes[i];
+      }
+    }
+    for(i=0; i<opts.nsweep_counts; i++) {
+      if(opts.sweep_counts[i] > max_count) {
+        max_count = opts.sweep_counts[i];
+      }
+    }
+    buffer_size = max_size + (max_count-1) * alignment;
+    if((errno=posix_memalign((void **)&buffer, alignment, buffer_size))) {
+      perror("posix_memalign");
+      return 1;
+    }
+    srandom(SEED);
+    for(i=0; i < buffer_size; i++) {
+      buffer[i] = random() % 0xff;
+    }
+    printf("sweeping %d points\n", opts.nsweep_sizes * opts.nsweep_counts *
+        nlengths * opts.nsweep_depths * opts.nsweep_jobs);
+    sigaction(SIGINT, &sigact, NULL);
+    return sweep_run(filename, buffer, alignment, &opts, lengths, nlengths,
+        niters) ? 1 : 0;
+  }
+
   // Allocate buffer with suitable alignment
   buffer_size = opts.chunk_size + (opts.chunk_count-1)*alignment;
   if((errno=posix_memalign((void **)&buffer, alignment, buffer_size))) {
@@ -505,8 +6447,46 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  // Pick up where a saved run stopped.  The saved seed replaces SEED so that
+  // the buffer (and therefore the data layout) matches the original run.
+  seed = SEED;
+  state.seed = seed;
+  snprintf(state.mode, sizeof(state.mode), "%s", mode);
+  state.chunk_size = opts.chunk_size;
+  state.chunk_count = opts.chunk_count;
+  state.file_size = file_size;
+  state.iters = niters;
+  if(opts.resume) {
+    if(state_load(opts.state, &state)) {
+      return 1;
+    }
+    if(strcmp(state.mode, mode) ||
+        state.chunk_size != opts.chunk_size ||
+        state.chunk_count != opts.chunk_count ||
+        state.file_size != file_size ||
+        state.rotation != state.completed % opts.chunk_count) {
+      printf("error: %s does not match the current parameters\n",
+          opts.state);
+      return 1;
+    }
+    seed = state.seed;
+    state.iters = niters;
+    first_iter = state.completed;
+    total_bytes = state.bytes;
+    memcpy(mix_xsubi, state.mix_xsubi, sizeof(mix_xsubi));
+    memcpy(rmw_xsubi, state.rmw_xsubi, sizeof(rmw_xsubi));
+    memcpy(discard_xsubi, state.discard_xsubi, sizeof(discard_xsubi));
+    if(niters != 0 && first_iter >= niters) {
+      printf("run saved in %s already completed %d iterations\n",
+          opts.state, first_iter);
+      return 0;
+    }
+    printf("resuming at iteration %d with %lu bytes done\n", first_iter,
+        total_bytes);
+  }
+
   // Fill buffer with random data
-  srandom(SEED);
+  srandom(seed);
   for(i=0; i < buffer_size; i++) {
     buffer[i] = random() % 0xff;
   }
@@ -539,7 +6519,300 @@ int main(int argc, char *argv[])
     iovs[i].iov_len = opts.chunk_size;
   }
 
+  // Allocate latency histograms
+  whist = calloc(1, sizeof(*whist));
+  if(!whist) {
+    perror("calloc[whist]");
+    return 1;
+  }
+
+  // Pace I/O to opts.rate bytes per second
+  if(opts.rate) {
+    rate_pacer.rate = opts.rate;
+    rate_pacer.ns_per_byte = 1e9 / opts.rate;
+    rate_pacer.burst_ns = RATE_BURST_NS;
+    pacer = &rate_pacer;
+  }
+
+  // Start the watchdog before any I/O is issued.  Slot 0 is for synchronous
+  // I/O, followed by one slot per iocb of the aio engine.
+  if(opts.watchdog_warn > 0) {
+    watchdog.warn = opts.watchdog_warn;
+    watchdog.abort = opts.watchdog_abort;
+    if(watchdog_start(&watchdog, filename, 1 + opts.iodepth)) {
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("watchdog warning after %.1f s", opts.watchdog_warn);
+      if(opts.watchdog_abort > 0) {
+        printf(", exiting after %.1f s", opts.watchdog_abort);
+      }
+      printf("\n");
+    }
+  }
+
+  // The flush microbenchmark has its own loop
+  if(opts.flush_ops) {
+    sigaction(SIGINT, &sigact, NULL);
+    return flush_run(filename, file_size, buffer, alignment, opts.chunk_size,
+        iovs, opts.flush_sizes, opts.nflush_sizes,
+        opts.flush_depths, opts.nflush_depths, opts.flush_ops,
+        opts.verbose) ? 1 : 0;
+  }
+
+  // Replay mode has its own loop
+  if(opts.replay) {
+    if(opts.engine == engine_aio && aio_engine_init(&eng, opts.iodepth)) {
+      return 1;
+    }
+    sigaction(SIGINT, &sigact, NULL);
+    return replay_run(opts.replay, filename, buffer, alignment,
+        opts.chunk_size, opts.chunk_count,
+        opts.engine == engine_aio ? &eng : NULL, opts.replay_speed,
+        niters) ? 1 : 0;
+  }
+
+  // Zoned mode has its own loop
+  if(opts.zoned) {
+    if(opts.engine == engine_aio && aio_engine_init(&eng, opts.iodepth)) {
+      return 1;
+    }
+    sigaction(SIGINT, &sigact, NULL);
+    return zoned_run(filename, file_size, opts.chunk_size, opts.chunk_count,
+        iovs, opts.engine == engine_aio ? &eng : NULL, niters) ? 1 : 0;
+  }
+
+  // Fill mode has its own loop
+  if(opts.fill > 0) {
+    sigaction(SIGINT, &sigact, NULL);
+    return fill_run(filename, file_size, file_chunks, opts.chunk_size,
+        opts.chunk_count, iovs, opts.fill, opts.age, niters) ? 1 : 0;
+  }
+
   oflags = O_WRONLY | O_CREAT | O_DIRECT;
+
+  // Reads land in a separate aligned buffer so that the data being written
+  // (or verified) is never disturbed by the reads.  The sync engine reads up
+  // to read_batch chunks per call in read mode.  The aio engine needs one
+  // chunk for each I/O in flight.
+  if(opts.read_mode) {
+    oflags = O_RDONLY | O_DIRECT;
+    read_batch = opts.iovs ? opts.iovs : READ_BATCH_BYTES / opts.chunk_size;
+    if(read_batch > IOV_MAX) {
+      read_batch = IOV_MAX;
+    } else if(read_batch == 0) {
+      read_batch = 1;
+    }
+    if(read_batch > file_chunks) {
+      read_batch = file_chunks;
+    }
+    rbuf_size = read_batch * opts.chunk_size;
+  } else if(opts.rwmix >= 0) {
+    oflags = O_RDWR | O_CREAT | O_DIRECT;
+    rbuf_size = opts.chunk_size;
+  } else if(opts.rmw_min) {
+    // Partial overwrites go through the page cache, which has to read in
+    // (or already hold) the rest of each page that is written.
+    oflags = O_RDWR | O_CREAT;
+    shist = calloc(1, sizeof(*shist));
+    if(!shist) {
+      perror("calloc[shist]");
+      return 1;
+    }
+  } else if(opts.wal_record) {
+    // Log records are small and unaligned, so the log is written through the
+    // page cache and starts out empty on each iteration.
+    oflags = O_WRONLY | O_CREAT | O_TRUNC;
+    if(opts.wal_sync == wal_sync_dsync) {
+      oflags |= O_DSYNC;
+    }
+  }
+  if(opts.engine == engine_aio && rbuf_size) {
+    rbuf_size = opts.iodepth * opts.chunk_size;
+  }
+  if(rbuf_size) {
+    if((errno=posix_memalign((void **)&rbuf, alignment, rbuf_size))) {
+      perror("posix_memalign[rbuf]");
+      return 1;
+    }
+    if(mlock(rbuf, rbuf_size)) {
+      perror("mlock[rbuf]");
+      return 1;
+    }
+    rhist = calloc(1, sizeof(*rhist));
+    if(!rhist) {
+      perror("calloc[rhist]");
+      return 1;
+    }
+  }
+
+  if(opts.open_iops > 0) {
+    arrivals.iops = opts.open_iops;
+    arrivals.poisson = opts.poisson;
+    arrivals.on = opts.burst_on;
+    arrivals.off = opts.burst_off;
+    arrivals.xsubi[0] = 0x0a77;
+    arrivals.xsubi[1] = SEED & 0xffff;
+    arrivals.xsubi[2] = (SEED >> 16) & 0xffff;
+    arrivals.response = calloc(1, sizeof(*arrivals.response));
+    if(!arrivals.response) {
+      perror("calloc[response]");
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("open loop %s arrivals at %.0f I/Os per second",
+          opts.poisson ? "Poisson" : "fixed", opts.open_iops);
+      if(opts.burst_on > 0) {
+        printf(" for %.3f s of every %.3f s", opts.burst_on,
+            opts.burst_on + opts.burst_off);
+      }
+      printf("\n");
+    }
+  }
+
+  if(opts.engine == engine_aio) {
+    if(aio_engine_init(&eng, opts.iodepth)) {
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("using aio engine with iodepth %d\n", opts.iodepth);
+    }
+    if(opts.target_p99 > 0) {
+      adaptive.target_ns = opts.target_p99 * 1e9 + 0.5;
+      adaptive.depth = 1;
+      adaptive.max_depth = opts.iodepth;
+      adaptive.verbose = opts.verbose;
+      adaptive.start_ns = adaptive.last_ns = mono_ns();
+      depth_ctl = &adaptive;
+    }
+  }
+
+  if(opts.files) {
+    mhists = calloc(1, sizeof(*mhists));
+    if(!mhists) {
+      perror("calloc[mhists]");
+      return 1;
+    }
+    // Create directory tree up front so it is not part of the measurement
+    snprintf(dirpath, sizeof(dirpath), "%s", filename);
+    if(meta_mkdirs(dirpath, sizeof(dirpath), opts.fanout_width,
+          opts.fanout_width ? opts.fanout_depth : 0)) {
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("using %d threads and fanout %d:%d%s%s\n", opts.threads,
+          opts.fanout_width, opts.fanout_depth,
+          opts.fsync ? " with fsync" : "", opts.unlink ? " with unlink" : "");
+    }
+  }
+
+  wctl.max_iovs = opts.iovs;
+
+  // Set up sync cadence of the write loop.  Byte based sync points are
+  // rounded to whole chunks.
+  if(opts.sync_mode != sync_none) {
+    wctl.sync_mode = opts.sync_mode;
+    if(opts.sync_mode == sync_every) {
+      wctl.sync_every = opts.sync_every;
+    } else if(opts.sync_mode == sync_bytes) {
+      wctl.sync_every = opts.sync_every / opts.chunk_size;
+      if(wctl.sync_every == 0) {
+        wctl.sync_every = 1;
+      }
+    }
+    wctl.sync_call = opts.sync_call;
+    wctl.sync_hist = shist = calloc(1, sizeof(*shist));
+    if(!shist) {
+      perror("calloc[shist]");
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("syncing with %s ", sync_call_names[opts.sync_call]);
+      if(opts.sync_mode == sync_iter) {
+        printf("every iteration\n");
+      } else {
+        printf("every %lu chunks\n", wctl.sync_every);
+      }
+    }
+  }
+
+  // Tolerant mode starts from the known bad regions, if any
+  if(opts.tolerant) {
+    bad.path = opts.bad_map;
+    if(bad.path && bad_map_load(&bad)) {
+      return 1;
+    }
+    wctl.bad = &bad;
+    wctl.retries = opts.retries;
+    wctl.retry_delay = opts.retry_delay;
+    wctl.error_budget = opts.error_budget;
+    printf("tolerating up to %lu write errors with %d retries",
+        opts.error_budget, opts.retries);
+    if(bad.n) {
+      printf(", skipping %lu known bad regions", bad.n);
+    }
+    printf("\n");
+  }
+
+  // Write-behind goes through the page cache, so the pages of each window
+  // have to be written back explicitly.
+  if(opts.wb_window) {
+    oflags &= ~O_DIRECT;
+    wctl.wb_window = opts.wb_window / opts.chunk_size;
+    if(wctl.wb_window == 0) {
+      wctl.wb_window = 1;
+    }
+    wctl.wb_lag = opts.wb_lag;
+    wctl.wb_drop = opts.wb_drop;
+    wctl.wb_hist = calloc(1, sizeof(*wctl.wb_hist));
+    if(!wctl.wb_hist) {
+      perror("calloc[wb_hist]");
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("writing behind every %lu chunks, waiting %d windows back%s\n",
+          wctl.wb_window, wctl.wb_lag,
+          wctl.wb_drop ? " and dropping them" : "");
+    }
+  }
+
+  // An explicit I/O mode replaces the O_DIRECT default.  In A/B mode, even
+  // iterations use the --io mode and odd iterations use the --ab mode.
+  if(opts.io >= 0) {
+    oflags = (oflags & ~O_DIRECT) | io_mode_flags[opts.io];
+  }
+  ab_oflags[0] = oflags;
+  if(opts.ab_io >= 0) {
+    nconfigs = 2;
+    ab_oflags[1] = (oflags & ~(O_DIRECT | O_DSYNC | O_SYNC)) |
+      io_mode_flags[opts.ab_io];
+    if(opts.verbose) {
+      printf("alternating iterations between %s and %s I/O\n",
+          io_mode_names[opts.io >= 0 ? opts.io : io_direct],
+          io_mode_names[opts.ab_io]);
+    }
+  }
+  if(opts.io >= 0 || opts.ab_io >= 0) {
+    direct_fallback = 0;
+  }
+
+  if(opts.discard > 0) {
+    dhist = calloc(1, sizeof(*dhist));
+    if(!dhist) {
+      perror("calloc[dhist]");
+      return 1;
+    }
+    if(opts.verbose) {
+      printf("discarding %.1f%% of %s between iterations\n",
+          100 * opts.discard, filename);
+    }
+  }
+
+  vstate.buffer = buffer;
+  vstate.alignment = alignment;
+  vstate.chunk_size = opts.chunk_size;
+  vstate.chunk_count = opts.chunk_count;
+  vstate.errors = 0;
   fflush(stdout);
 
   // Install signal handler for SIGINT (ctrl-C).  The SIGINT handler will exit
@@ -547,91 +6820,167 @@ int main(int argc, char *argv[])
   // a second SIGINT signal will interrupt the program immediately.
   sigaction(SIGINT, &sigact, NULL);
 
+  if(opts.total_bytes) {
+    printf("stopping once %lu bytes have been moved in total\n",
+        opts.total_bytes);
+  }
+  if(opts.runtime > 0) {
+    format_duration(streta, sizeof(streta), opts.runtime);
+    printf("stopping after running for %s\n", streta);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &run_start);
+  last_report = run_start;
+
   // Main loop
-  for(i=0; run && (i < niters || niters == 0); i++) {
+  for(i=first_iter; run && !stop_reached && (i < niters || niters == 0);
+      i++) {
+    // Warmup iterations run as usual, but statistics are reset after each of
+    // them
+    clock_gettime(CLOCK_MONOTONIC, &report_ts);
+    warming = i - first_iter < opts.warmup_iters ||
+      ELAPSED_NS(run_start, report_ts) < opts.warmup_secs * 1e9;
+
+    // Discard (part of) the target region written by the previous iteration.
+    // This is timed separately and is not included in the write throughput.
+    if(opts.discard > 0 && i > 0) {
+      if(discard_pass(filename, file_chunks, opts.chunk_size, opts.discard,
+            discard_xsubi, dhist, &dtot)) {
+        return 1;
+      }
+      time(&now);
+      strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
+      printf("%s discarded %lu bytes in %lu ns\n", strnow,
+          dtot.bytes, dtot.ns);
+    }
+
+    // Start from a cold page cache.  This is not timed.
+    if(opts.drop_cache && drop_cache(filename)) {
+      return 1;
+    }
+
     // Get start time
     clock_gettime(CLOCK_MONOTONIC, &start);
 
-    // Open file
-    fd = open(filename, oflags, 0666);
-    if(fd == -1) {
-      // Maybe O_DIRECT is not supported?
-      if(errno == EINVAL && i == 0 && (oflags & O_DIRECT)) {
-        oflags &= ~O_DIRECT;
-        // Open file
-        fd = open(filename, oflags, 0666);
-        if(fd == -1) {
-          perror(filename);
-          return 1;
-        } else {
-          printf("warning: O_DIRECT not supported for %s\n", filename);
-        }
-      } else {
-        perror(filename);
+    // Open file (the metadata workload opens its own files)
+    fd = -1;
+    ab = i % nconfigs;
+    if(!opts.files) {
+      fd = open_target(filename, &ab_oflags[ab], (i - first_iter) / nconfigs);
+      if(fd == -1) {
         return 1;
       }
     }
 
-    // Write file...
-
     piov = &iovs[i % opts.chunk_count];
-    iovs_remaining = file_chunks;
-    while(iovs_remaining > 0) {
-      // The number of iovecs that can be written in one call to writev is
-      // limited to IOV_MAX.
-      iovs_to_write = (iovs_remaining > IOV_MAX) ? IOV_MAX : iovs_remaining;
-
-      // Furthermore, the total number of bytes written must not exceed
-      // SSIZE_MAX, the maximum value of ssize_t (signed size_t).  This means
-      // we have to loop through iovs in case file_chunks is greater than
-      // IOV_MAX or if IOVMAX (or fewer) iovs will exceed SSIZE_MAX.
-      if(iovs_to_write * opts.chunk_size > (size_t)SSIZE_MAX) {
-        iovs_to_write = (size_t)SSIZE_MAX / opts.chunk_size;
-      }
-
-      // Write data
-      if((bytes_written = writev(fd, piov, iovs_to_write)) == -1) {
-        // Error
-        perror("writev");
-        fprintf(stderr, "iter %d iovs_remaining %ld iovs_to_write %ld\n",
-            i, iovs_remaining, iovs_to_write);
-        fprintf(stderr, "piov %p iov_base %p iov_len %lu\n",
-            piov, piov->iov_base, piov->iov_len);
-        return 1;
-      } else if(bytes_written < iovs_to_write * opts.chunk_size) {
-        // Incomplete write
-        // Set iovs_to_write to the number of complete iovs written.
-        iovs_to_write = bytes_written / opts.chunk_size;
-        // Set bytes_written_partial to number of bytes written from next iov
-        bytes_written_partial = bytes_written % opts.chunk_size;
-        // If any bytes were written from the next iov
-        if(bytes_written_partial > 0) {
-          // Increment iov pointer, decrement iov length
-          piov[iovs_to_write].iov_base += bytes_written_partial;
-          piov[iovs_to_write].iov_len  -= bytes_written_partial;
-          // Write remainder of partially written iov
-          if((bytes_written = writev(fd, &piov[iovs_to_write], 1)) == -1) {
-            // Error
-            perror("writev[partal]");
-            return 1;
-          } else if(bytes_written < bytes_written_partial) {
-            printf("error: double incomplete writes not supported\n");
+
+    if(opts.rwmix >= 0 || opts.rmw_min) {
+      // Reads must find data in the target region, so fill any part of it
+      // that does not yet exist before the first mixed pass.  Likewise the
+      // partial overwrite workload needs an existing file to overwrite.
+      if(i == first_iter) {
+        if(fstat(fd, &st) == -1) {
+          perror("fstat");
+          return 1;
+        }
+        if(S_ISREG(st.st_mode) && st.st_size < file_size) {
+          printf("prefilling %ld bytes of %s\n", file_size, filename);
+          fflush(stdout);
+          // The prefill is not paced
+          pacer = NULL;
+          if(write_pass(fd, piov, file_chunks, opts.chunk_size, i, NULL,
+                NULL)) {
             return 1;
           }
-          // Increment iov pointer, decrement iov length
-          piov[iovs_to_write].iov_base -= bytes_written_partial;
-          piov[iovs_to_write].iov_len  += bytes_written_partial;
-          iovs_to_write++;
+          pacer = opts.rate ? &rate_pacer : NULL;
         }
+        // Device stats come from the device holding the file, or the device
+        // itself
+        stats_dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+      }
+    }
+
+    if(opts.rmw_min) {
+      // Overwrite records and sync, noting how much the device wrote.  The
+      // prefill (if any) is synced first so it is not counted.
+      if(i == first_iter && fdatasync(fd) == -1) {
+        perror("fdatasync");
+        return 1;
+      }
+      have_stats = !read_diskstats(stats_dev, &ds_start);
+      if(rmw_pass(fd, buffer, opts.chunk_size, file_size, opts.rmw_min,
+            opts.rmw_max, file_chunks, rmw_xsubi, i, whist, shist,
+            &rmw_bytes)) {
+        return 1;
+      }
+      have_stats = have_stats && !read_diskstats(stats_dev, &ds_stop);
+    } else if(opts.rwmix >= 0) {
+      // Mix reads and writes
+      memset(&rtot, 0, sizeof(rtot));
+      memset(&wtot, 0, sizeof(wtot));
+      if(mixed_pass(fd, piov, file_chunks, opts.chunk_size, opts.rwmix,
+            rbuf, mix_xsubi, i, rhist, whist, &rtot, &wtot)) {
+        return 1;
+      }
+    } else if(opts.files) {
+      // Create, write, fsync and unlink files.  Files are only left behind
+      // without --unlink, or by an earlier run.
+      if(meta_pass(filename, buffer, alignment, opts.chunk_count,
+            opts.chunk_size, opts.fanout_width, opts.fanout_depth,
+            opts.fsync, opts.unlink, !opts.unlink || i == first_iter,
+            opts.files, opts.threads, mhists)) {
+        return 1;
+      }
+    } else if(opts.wal_record) {
+      // Append and commit records
+      if(wal_pass(fd, opts.wal_sync, buffer, alignment, opts.chunk_count,
+            opts.wal_record, wal_records, opts.committers, whist,
+            &wal_syncs)) {
+        return 1;
+      }
+    } else if(opts.open_iops > 0) {
+      // Read or write file as chunk I/Os arrive
+      vstate.rot = -1;
+      if(open_pass(opts.engine == engine_aio ? &eng : NULL, fd,
+            opts.read_mode, piov, file_chunks, opts.chunk_size, rbuf, i,
+            opts.read_mode ? rhist : whist, opts.verify ? &vstate : NULL,
+            &arrivals)) {
+        return 1;
+      }
+    } else if(opts.engine == engine_aio) {
+      // Read or write file with chunk I/Os in flight
+      vstate.rot = -1;
+      if(aio_pass(&eng, fd, opts.read_mode, 0, piov, file_chunks,
+            opts.chunk_size, rbuf, i, opts.read_mode ? rhist : whist,
+            opts.verify ? &vstate : NULL)) {
+        return 1;
+      }
+    } else if(opts.read_mode) {
+      // Read file...
+      vstate.rot = -1;
+      if(read_pass(fd, rbuf, read_batch, file_chunks, opts.chunk_size, i,
+            rhist, opts.verify ? &vstate : NULL)) {
+        return 1;
+      }
+    } else {
+      // Write file...
+      if(write_pass(fd, piov, file_chunks, opts.chunk_size, i, whist,
+            &wctl)) {
+        return 1;
       }
+    }
 
-      // Increment iovs pointer and iovs remaining basond on iovs_to_write
-      piov += iovs_to_write;
-      iovs_remaining -= iovs_to_write;
+    // Sync at end of iteration, before closing
+    if(opts.sync_mode == sync_iter) {
+      if((sync_ns = sync_range(fd, opts.sync_call, 0, file_size,
+              shist)) < 0) {
+        return 1;
+      }
+      wctl.nsyncs = 1;
+      wctl.sync_ns = sync_ns;
     }
 
     // Close file
-    if(close(fd) == -1) {
+    if(fd != -1 && close(fd) == -1) {
       perror("close");
       return 1;
     }
@@ -640,15 +6989,308 @@ int main(int argc, char *argv[])
     clock_gettime(CLOCK_MONOTONIC, &stop);
     elapsed_ns = ELAPSED_NS(start, stop);
 
+    // Bytes moved by this iteration
+    if(opts.files) {
+      iter_bytes = opts.files * opts.chunk_size;
+    } else if(opts.wal_record) {
+      iter_bytes = wal_records * opts.wal_record;
+    } else if(opts.rmw_min) {
+      iter_bytes = rmw_bytes;
+    } else if(opts.rwmix >= 0) {
+      iter_bytes = rtot.bytes + wtot.bytes;
+    } else {
+      iter_bytes = file_size;
+    }
+    // The lifetime total counts bytes written (bytes read in read mode)
+    iter_total = opts.rwmix >= 0 ? wtot.bytes : iter_bytes;
+    total_bytes += iter_total;
+
+    // Throughput of the measured iterations for --json
+    if(opts.json && !warming) {
+      json_gbps = realloc(json_gbps, (njson_gbps + 1) * sizeof(*json_gbps));
+      if(!json_gbps) {
+        perror("realloc[json]");
+        return 1;
+      }
+      json_gbps[njson_gbps++] = (8.0 * iter_bytes) / elapsed_ns;
+    }
+
+    if(nconfigs > 1) {
+      abtot[ab].bytes += file_size;
+      abtot[ab].ns += elapsed_ns;
+      ab_label = io_mode_names[ab ? opts.ab_io :
+        opts.io >= 0 ? opts.io : io_direct];
+    }
+
     // Output timing stats
     // TODO Limit/aggregate stats reports if elapsed time is short?
     time(&now);
     strftime(strnow, sizeof(strnow), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
-    printf("%s wrote %lu bytes in %lu ns (%.3f Gbps)\n",
-        strnow, file_size, elapsed_ns, (8.0 * file_size)/elapsed_ns);
+    if(warming) {
+      strcat(strnow, " warmup");
+    }
+    if(opts.files) {
+      printf("%s created %lu files in %lu ns (%.0f files/s, %.3f Gbps)\n",
+          strnow, opts.files, elapsed_ns, 1e9 * opts.files / elapsed_ns,
+          (8.0 * opts.files * opts.chunk_size)/elapsed_ns);
+    } else if(opts.wal_record) {
+      printf("%s committed %lu records in %lu ns (%.0f commits/s,"
+          " %lu syncs, %.3f Gbps)\n", strnow, wal_records, elapsed_ns,
+          1e9 * wal_records / elapsed_ns, wal_syncs,
+          (8.0 * wal_records * opts.wal_record)/elapsed_ns);
+    } else if(opts.rmw_min) {
+      printf("%s wrote %lu bytes in %lu ns (%.3f Gbps)", strnow, rmw_bytes,
+          elapsed_ns, (8.0 * rmw_bytes)/elapsed_ns);
+      if(have_stats) {
+        printf(" device wrote %lu bytes (WA %.2f)\n",
+            512 * (ds_stop.sectors_written - ds_start.sectors_written),
+            512.0 * (ds_stop.sectors_written - ds_start.sectors_written)
+              / rmw_bytes);
+      } else {
+        printf(" device writes unavailable\n");
+      }
+    } else if(opts.rwmix >= 0) {
+      // Throughput for each direction is based on the time spent in calls
+      // for that direction.
+      printf("%s wrote %lu bytes in %lu ns (%.3f Gbps)"
+          " read %lu bytes in %lu ns (%.3f Gbps)\n", strnow,
+          wtot.bytes, wtot.ns, wtot.ns ? (8.0 * wtot.bytes)/wtot.ns : 0.0,
+          rtot.bytes, rtot.ns, rtot.ns ? (8.0 * rtot.bytes)/rtot.ns : 0.0);
+    } else if(opts.sync_mode != sync_none) {
+      // Throughput includes the syncs, which are also shown separately
+      printf("%s wrote %lu bytes in %lu ns (%.3f Gbps) %lu syncs in %lu ns"
+          " (%.3f Gbps excluding syncs)%s%s\n", strnow, file_size, elapsed_ns,
+          (8.0 * file_size)/elapsed_ns, wctl.nsyncs, wctl.sync_ns,
+          (8.0 * file_size)/(elapsed_ns - wctl.sync_ns),
+          *ab_label ? " " : "", ab_label);
+    } else {
+      printf("%s %s %lu bytes in %lu ns (%.3f Gbps)%s%s\n", strnow,
+          opts.read_mode ? "read" : "wrote",
+          file_size, elapsed_ns, (8.0 * file_size)/elapsed_ns,
+          *ab_label ? " " : "", ab_label);
+    }
+    // Check the stop conditions and show progress towards them.  The ETA is
+    // based on an exponentially weighted moving average of the throughput
+    // of recent iterations, including any time spent between them.
+    if(opts.total_bytes || opts.runtime > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &report_ts);
+      run_secs = ELAPSED_NS(run_start, report_ts) / 1e9;
+      report_secs = ELAPSED_NS(last_report, report_ts) / 1e9;
+      last_report = report_ts;
+      if(report_secs > 0) {
+        rate_ewma = rate_ewma == 0 ? iter_total / report_secs :
+          0.8 * rate_ewma + 0.2 * iter_total / report_secs;
+      }
+
+      stop_reached = (opts.total_bytes && total_bytes >= opts.total_bytes) ||
+        (opts.runtime > 0 && run_secs >= opts.runtime);
+      eta = -1;
+      if(opts.total_bytes && rate_ewma > 0) {
+        eta = (opts.total_bytes > total_bytes ?
+            opts.total_bytes - total_bytes : 0) / rate_ewma;
+      }
+      if(opts.runtime > 0 && (eta < 0 || opts.runtime - run_secs < eta)) {
+        eta = opts.runtime > run_secs ? opts.runtime - run_secs : 0;
+      }
+      if(niters > 0 && rate_ewma > 0 &&
+          (niters - i - 1) * iter_total / rate_ewma < eta) {
+        eta = (niters - i - 1) * iter_total / rate_ewma;
+      }
+
+      printf("%s progress: %lu bytes in total", strnow, total_bytes);
+      if(opts.total_bytes) {
+        printf(" (%.1f%% of %lu)", 100.0 * total_bytes / opts.total_bytes,
+            opts.total_bytes);
+      }
+      format_duration(streta, sizeof(streta), run_secs);
+      printf(", running for %s, trend %.3f Gbps", streta,
+          8.0 * rate_ewma / 1e9);
+      if(eta >= 0) {
+        format_duration(streta, sizeof(streta), eta);
+        printf(", ETA %s", streta);
+      }
+      printf("\n");
+    }
+
+    // Save the run state every opts.checkpoint iterations and after the last
+    // iteration
+    if(opts.state && ((i + 1) % opts.checkpoint == 0 || !run ||
+          stop_reached || i + 1 == niters)) {
+      state.completed = i + 1;
+      state.bytes = total_bytes;
+      state.rotation = (i + 1) % opts.chunk_count;
+      memcpy(state.mix_xsubi, mix_xsubi, sizeof(mix_xsubi));
+      memcpy(state.rmw_xsubi, rmw_xsubi, sizeof(rmw_xsubi));
+      memcpy(state.discard_xsubi, discard_xsubi, sizeof(discard_xsubi));
+      if(state_save(opts.state, &state)) {
+        return 1;
+      }
+    }
+
+    // Duty cycle: once the iterations since the last idle period have run
+    // for opts.duty_on, idle for opts.duty_off.  The first iteration after
+    // an idle period is compared to the last one before it, which shows how
+    // much performance the device recovered while idle.
+    if(opts.duty_on > 0) {
+      iter_gbps = (8.0 * iter_bytes) / elapsed_ns;
+      if(after_idle) {
+        printf("%s recovery: %.3f Gbps after idle vs %.3f Gbps before"
+            " (%+.1f%%)\n", strnow, iter_gbps, idle_gbps,
+            100 * (iter_gbps / idle_gbps - 1));
+        recovery_sum += iter_gbps / idle_gbps;
+        nrecovered++;
+        after_idle = 0;
+      }
+      duty_secs += elapsed_ns / 1e9;
+      if(duty_secs >= opts.duty_on && run && !stop_reached &&
+          (niters == 0 || i + 1 < niters)) {
+        printf("%s idling for %.1f s\n", strnow, opts.duty_off);
+        fflush(stdout);
+        idle.tv_sec = opts.duty_off;
+        idle.tv_nsec = (opts.duty_off - idle.tv_sec) * 1e9;
+        // SIGINT ends the idle period (and the run)
+        while(nanosleep(&idle, &idle) == -1 && errno == EINTR && run) {
+        }
+        idle_gbps = iter_gbps;
+        after_idle = 1;
+        duty_secs = 0;
+        nidle++;
+      }
+    }
+
+    // Statistics start afresh after the last warmup iteration
+    if(warming) {
+      memset(whist, 0, sizeof(*whist));
+      if(rhist) {
+        memset(rhist, 0, sizeof(*rhist));
+      }
+      if(shist) {
+        memset(shist, 0, sizeof(*shist));
+      }
+      if(dhist) {
+        memset(dhist, 0, sizeof(*dhist));
+      }
+      if(mhists) {
+        memset(mhists, 0, sizeof(*mhists));
+      }
+      if(wctl.wb_hist) {
+        memset(wctl.wb_hist, 0, sizeof(*wctl.wb_hist));
+      }
+      if(arrivals.response) {
+        memset(arrivals.response, 0, sizeof(*arrivals.response));
+      }
+      memset(abtot, 0, sizeof(abtot));
+      adaptive.nwindows = 0;
+      recovery_sum = 0;
+      nrecovered = 0;
+    }
+
     // Flush stdout so that output redirected to a log file can be tailed
     fflush(stdout);
   }
 
+  if(opts.duty_on > 0 && nrecovered) {
+    printf("duty cycle: %d idle periods, mean recovery %+.1f%%\n", nidle,
+        100 * (recovery_sum / nrecovered - 1));
+  }
+  if(opts.state || opts.total_bytes || opts.runtime > 0) {
+    printf("%d iterations and %lu bytes done in total\n", i, total_bytes);
+  }
+  if(depth_ctl) {
+    if(adaptive.nwindows) {
+      printf("adaptive depth: converged to %.1f at %.3f Gbps over %d windows"
+          " (p99 target %lu ns)\n", adaptive.avg_depth, adaptive.avg_gbps,
+          adaptive.nwindows, adaptive.target_ns);
+    } else {
+      printf("adaptive depth: run too short to adjust depth\n");
+    }
+  }
+  if(opts.rate && rate_pacer.start_ns) {
+    run_secs = (mono_ns() - rate_pacer.start_ns) / 1e9;
+    printf("rate: requested %lu, achieved %.0f bytes/s, paced for %.3f s\n",
+        opts.rate, rate_pacer.bytes / run_secs, rate_pacer.paced_ns / 1e9);
+  }
+
+  // Output latency summaries
+  if(opts.rwmix >= 0) {
+    summary_print("write", whist);
+    summary_print("read", rhist);
+  } else if(opts.read_mode && opts.open_iops > 0) {
+    summary_print("read service", rhist);
+    summary_print("read response", arrivals.response);
+  } else if(opts.read_mode) {
+    summary_print("read", rhist);
+  } else if(opts.files) {
+    summary_print("create", &mhists->create);
+    summary_print("write", &mhists->write);
+    if(opts.fsync) {
+      summary_print("fsync", &mhists->fsync);
+    }
+    if(opts.unlink) {
+      summary_print("unlink", &mhists->unlink);
+    }
+  } else if(opts.wal_record) {
+    summary_print("commit", whist);
+  } else if(opts.rmw_min) {
+    summary_print("write", whist);
+    summary_print("sync", shist);
+  } else if(opts.open_iops > 0) {
+    // Service time is from issue, response time is from arrival
+    summary_print("write service", whist);
+    summary_print("write response", arrivals.response);
+  } else if(opts.engine == engine_aio || opts.rate || opts.json) {
+    // Latencies exclude time spent waiting for the rate limit
+    summary_print("write", whist);
+  }
+
+  if(opts.discard > 0) {
+    summary_print("discard", dhist);
+  }
+  if(opts.sync_mode != sync_none) {
+    summary_print("sync", shist);
+  }
+  if(opts.wb_window) {
+    summary_print("write-behind wait", wctl.wb_hist);
+  }
+  if(opts.tolerant) {
+    printf("errors: %lu new bad chunks, %lu recovered on retry,"
+        " %lu bad chunk writes skipped\n", bad.errors, bad.recovered,
+        bad.skipped);
+  }
+
+  // Compare the throughput of the two I/O modes
+  if(nconfigs > 1) {
+    for(ab=0; ab<2; ab++) {
+      printf("%s: %lu bytes in %lu ns (%.3f Gbps)\n",
+          io_mode_names[ab ? opts.ab_io : opts.io >= 0 ? opts.io : io_direct],
+          abtot[ab].bytes, abtot[ab].ns,
+          abtot[ab].ns ? (8.0 * abtot[ab].bytes)/abtot[ab].ns : 0.0);
+    }
+    if(abtot[0].ns && abtot[1].ns && abtot[0].bytes) {
+      printf("%s/%s throughput ratio: %.3f\n", io_mode_names[opts.ab_io],
+          io_mode_names[opts.io >= 0 ? opts.io : io_direct],
+          ((double)abtot[1].bytes / abtot[1].ns) /
+          ((double)abtot[0].bytes / abtot[0].ns));
+    }
+  }
+
+  if(opts.json) {
+    if(json_result(opts.json, mode, argc, argv, json_gbps, njson_gbps)) {
+      return 1;
+    }
+    free(json_gbps);
+  }
+
+  if(opts.engine == engine_aio) {
+    aio_engine_destroy(&eng);
+  }
+
+  if(opts.verify) {
+    printf("verify: %lu chunk errors\n", vstate.errors);
+    if(vstate.errors) {
+      return 1;
+    }
+  }
+
   return 0;
 }